@@ -0,0 +1,232 @@
+/*
+  Benchmarks of the dbg() hot path. Each case reports the time per record,
+  the bytes of the records per second and the allocations per record made by
+  the calling thread. The sink is the one dbg_bench_<sink> is compiled for,
+  see bench/CMakeLists.txt
+
+    dbg_bench_file --benchmark_filter=Vector
+    dbg_bench_stdout --benchmark_out=bench.json > /dev/null
+*/
+
+
+#include <cstdint>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "dbg.h"
+
+
+// Allocations made by the current thread, counted by the global operator new
+thread_local size_t allocations = 0;
+
+void *operator new(size_t size) {
+  ++allocations;
+  if (void *p = std::malloc(size == 0 ? 1 : size)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept {
+  std::free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+  std::free(p);
+}
+
+
+namespace {
+
+// The classes from the README, nested with DERIVE_DEBUG
+class Foo {
+  class Bar {
+    float pi = 3.14, e = 2.71;
+    std::shared_ptr<float> count{std::make_shared<float>(9.81)};
+
+   public:
+    DERIVE_DEBUG(pi * e, count);
+  };
+
+  std::map<std::string, float> map{{"light speed", 2.9e+8},
+                                   {"electron mass", 9.1e-31}};
+  std::vector<Bar> bars{Bar()};
+
+ public:
+  DERIVE_DEBUG(map, bars);
+};
+
+// Size of the record dbg() makes of the arguments with the given names. It's
+// rendered aside, nothing reaches the sink but the site entry of the binary log
+template <size_t N, class... Args>
+size_t RecordBytes(const std::array<std::string_view, N> &names,
+                   const Args &...args) {
+  static __dbg_internal::CallSite site{__FILE__, __LINE__, __func__};
+  __dbg_internal::Context &ctx = __dbg_internal::BeginRecord(site, {});
+  __dbg_internal::RecordArgs(ctx, site, names, args...);
+#if !defined(DBG_BINARY_LOG)
+  __dbg_internal::Writer::EndRecord(ctx);
+#endif
+  size_t bytes = ctx.buffer.View().size();
+  ctx.buffer.Clear();
+  return bytes + __dbg_internal::kRecordSeparator.size();
+}
+
+// Report the bytes per second and the allocations per record of the loop that
+// made one record of the given size per iteration
+void Report(benchmark::State &state, size_t record_bytes,
+            size_t allocations_before) {
+  state.SetBytesProcessed(state.iterations() * record_bytes);
+  state.counters["allocs/record"] = benchmark::Counter(
+      static_cast<double>(allocations - allocations_before) /
+          static_cast<double>(state.iterations()),
+      benchmark::Counter::kAvgThreads);
+}
+
+void BM_Scalar(benchmark::State &state) {
+  int x = 42;
+  size_t bytes = RecordBytes(DBG_ARG_NAMES(x), x);
+  size_t before = allocations;
+  for (auto _ : state) {
+    dbg(x);
+  }
+  Report(state, bytes, before);
+}
+BENCHMARK(BM_Scalar);
+
+void BM_String(benchmark::State &state) {
+  std::string msg = "dbg is fun!";
+  size_t bytes = RecordBytes(DBG_ARG_NAMES(msg), msg);
+  size_t before = allocations;
+  for (auto _ : state) {
+    dbg(msg);
+  }
+  Report(state, bytes, before);
+}
+BENCHMARK(BM_String);
+
+void BM_Vector(benchmark::State &state) {
+  std::vector<int> values(state.range(0));
+  for (size_t i = 0; i < values.size(); ++i) {
+    values[i] = static_cast<int>(i * 2654435761u);
+  }
+  size_t bytes = RecordBytes(DBG_ARG_NAMES(values), values);
+  size_t before = allocations;
+  for (auto _ : state) {
+    dbg(values);
+  }
+  Report(state, bytes, before);
+}
+BENCHMARK(BM_Vector)->Arg(1000)->Arg(1000000)->Arg(10000000);
+
+void BM_Map(benchmark::State &state) {
+  std::map<std::string, float> map;
+  for (int i = 0; i < 100; ++i) {
+    map.emplace("key " + std::to_string(i), i * 0.5f);
+  }
+  size_t bytes = RecordBytes(DBG_ARG_NAMES(map), map);
+  size_t before = allocations;
+  for (auto _ : state) {
+    dbg(map);
+  }
+  Report(state, bytes, before);
+}
+BENCHMARK(BM_Map);
+
+// The packet buffer is dumped in lines of offset, hex and chars
+void BM_Bytes(benchmark::State &state) {
+  std::vector<uint8_t> packet(state.range(0));
+  for (size_t i = 0; i < packet.size(); ++i) {
+    packet[i] = static_cast<uint8_t>(i * 2654435761u >> 24);
+  }
+  size_t bytes = RecordBytes(DBG_ARG_NAMES(packet), packet);
+  size_t before = allocations;
+  for (auto _ : state) {
+    dbg(packet);
+  }
+  Report(state, bytes, before);
+}
+BENCHMARK(BM_Bytes)->Arg(1500)->Arg(65536);
+
+void BM_Nested(benchmark::State &state) {
+  std::vector<Foo> foos(10);
+  size_t bytes = RecordBytes(DBG_ARG_NAMES(foos), foos);
+  size_t before = allocations;
+  for (auto _ : state) {
+    dbg(foos);
+  }
+  Report(state, bytes, before);
+}
+BENCHMARK(BM_Nested);
+
+// The nested classes compared by dbg_diff() with the last ones, they don't
+// change, so no record is made after the first one
+void BM_Diff(benchmark::State &state) {
+  std::vector<Foo> foos(10);
+  size_t before = allocations;
+  for (auto _ : state) {
+    dbg_diff(foos);
+  }
+  Report(state, 0, before);
+}
+BENCHMARK(BM_Diff);
+
+// The samples summarized by dbg_stats(), their record is of the same size
+// however many there are
+void BM_Stats(benchmark::State &state) {
+  std::vector<double> samples(state.range(0));
+  for (size_t i = 0; i < samples.size(); ++i) {
+    samples[i] = static_cast<double>(i * 2654435761u % 1000003) / 1000;
+  }
+  size_t before = allocations;
+  for (auto _ : state) {
+    dbg_stats(samples);
+  }
+  state.SetItemsProcessed(state.iterations() * samples.size());
+  Report(state, 0, before);
+}
+BENCHMARK(BM_Stats)->Arg(10000000);
+
+// The callers on several threads contend for the sink
+void BM_Threads(benchmark::State &state) {
+  int x = state.thread_index();
+  size_t bytes = RecordBytes(DBG_ARG_NAMES(x), x);
+  size_t before = allocations;
+  for (auto _ : state) {
+    dbg(x);
+  }
+  Report(state, bytes, before);
+}
+BENCHMARK(BM_Threads)->ThreadRange(1, 8)->UseRealTime();
+
+// The scope timed by dbg_time(), it makes no record per hit
+void BM_Time(benchmark::State &state) {
+  size_t before = allocations;
+  for (auto _ : state) {
+    dbg_time();
+  }
+  Report(state, 0, before);
+}
+BENCHMARK(BM_Time);
+
+// The values counted by dbg_count(), it makes no record per hit
+void BM_Count(benchmark::State &state) {
+  size_t before = allocations;
+  int i = 0;
+  for (auto _ : state) {
+    dbg_count(++i % 8);
+  }
+  Report(state, 0, before);
+}
+BENCHMARK(BM_Count);
+
+}  // namespace
+
+
+BENCHMARK_MAIN();
@@ -0,0 +1,15 @@
+/*
+  The compiled core of dbg.h for the programs of many translation units: the
+  sink, the flushes, the summaries and the common instantiations of
+  PrettyPrint(). Build it once along with the program, with DBG_SEPARATE_CORE
+  and the same DBG_* macros the other translation units include dbg.h with,
+  e.g. through the CMake target dbg_core
+*/
+
+
+#if !defined(DBG_SEPARATE_CORE)
+#error "dbg.cc is the core of the programs that define DBG_SEPARATE_CORE"
+#endif
+
+#define DBG_IMPLEMENTATION
+#include "dbg.h"
@@ -18,9 +18,33 @@
   in parentheses
 
   Brings into scope where it was included the following symbols:
-  dbg, DERIVE_DEBUG, DBG_DEMANGLE_CLASS_NAMES, DBG_WRITE_TO_FILE.
+  dbg, dbg_every_n, dbg_first_n, dbg_per_second, dbg_limit, dbg_dump,
+  dbg_time, dbg_count, dbg_hex, dbg_diff, dbg_stats, DERIVE_DEBUG,
+  DBG_ARG_NAMES,
+  DBG_RECORD, DBG_RECORD_WITH, DBG_CONCAT, DBG_LINE_NAME, DBG_WRITE_TO_FILE.
   None of the #include's arrive
 
+  dbg_time(...)
+  Time the enclosing scope into the histogram of the call site and report the
+  count, p50, p90, p99 and max of the durations on exit and by dbg_dump()
+
+  dbg_count(...)
+  Count the hits of the call site, or of each value of the scalar argument,
+  and report them on exit and by dbg_dump()
+
+  dbg_hex(...)
+  Print the bytes of the arguments in lines of offset, hex and ASCII. The
+  contiguous ranges of std::byte and unsigned char are dumped so by dbg() too
+
+  dbg_diff(...)
+  Print only what changed since the last record of the call site: the
+  arguments, the fields, the class elements and the map entries
+
+  dbg_stats(...)
+  Print the summary of the ranges of numbers instead of their elements: the
+  count, min, max, mean, stddev, the counts of NaN and infinities and the
+  histogram of the values between min and max
+
   By default debug information are piped into dbg.log file.
   And by default it's rewritten on each run. To append instead of rewrite define
   DBG_APPEND_TO_FILE macro before including this file:
@@ -33,935 +57,5905 @@
     #define DBG_WRITE_TO_STDOUT
     #include "dbg.h"
 
-  On GCC and Clang user-defined class names turn out to be correct, thanks to
-  their extension abi::__cxa_demangle. On MSVC class names can be mangled a bit
+  To send each record as one datagram to the collector instead, define
+  DBG_WRITE_TO_SOCKET as "udp:<host>:<port>" or "unix:<path>". The records are
+  sent in batches by the background writer of DBG_ASYNC, that it turns on:
+
+    #define DBG_WRITE_TO_SOCKET "udp:127.0.0.1:5140"
+    #include "dbg.h"
+
+  Each record is formatted into the buffer of the calling thread and reaches
+  the output only when complete, so records from different threads never
+  interleave. By default the calling thread writes it out itself. To hand the
+  records to the background writer thread instead define DBG_ASYNC:
+
+    #define DBG_ASYNC
+    #include "dbg.h"
+
+  Each thread takes the nodes of its records from its own DBG_ASYNC_NODES,
+  256 by default. Once all of them wait for the writer, the next record waits
+  until the writer is done with one, no record is dropped
+
+  To copy the records right into dbg.log mapped into the memory, with no
+  write() calls and no lock, define DBG_MAPPED_FILE:
+
+    #define DBG_MAPPED_FILE
+    #include "dbg.h"
+
+  To write the raw values into dbg.bin instead, and render the text offline
+  with tools/dbg_decode.cc, define DBG_BINARY_LOG:
+
+    #define DBG_BINARY_LOG
+    #include "dbg.h"
+
+  To write each record as one JSON line into dbg.ndjson instead, for the log
+  pipelines rather than the eyes, define DBG_JSON_LOG:
+
+    #define DBG_JSON_LOG
+    #include "dbg.h"
+
+  To keep the latest records in the memory of the threads and write them out
+  only on crash or dbg_dump(), define DBG_FLIGHT_RECORDER:
+
+    #define DBG_FLIGHT_RECORDER
+    #include "dbg.h"
+
+  To have each thread write its own file dbg.<n>.log with no lock shared by
+  the threads, and merge the files in the order the records were made with
+  tools/dbg_merge.cc, define DBG_SHARDED_LOG:
+
+    #define DBG_SHARDED_LOG
+    #include "dbg.h"
+
+  The header may be included into any number of translation units, they share
+  one sink. To have the sink and the common instantiations compiled once
+  instead, define DBG_SEPARATE_CORE for all of them and build dbg.cc along
+  with the same DBG_* macros:
+
+    #define DBG_SEPARATE_CORE
+    #include "dbg.h"
+
+  It's not a lighter header: each translation unit still parses all of dbg.h
+  and the standard headers its templates need, only <fstream>, <sstream>,
+  <iostream> and <cstdlib> are left to dbg.cc. The compile time it saves is
+  the one of the core and of the common instantiations, declared extern
+  template for the other translation units
+
+  With DBG_USAGE_TOP <sites> the call sites that made the most bytes of records
+  and the ones that spent the most time formatting them are reported on exit
+  and by dbg_dump(), <sites> of each, adding 2 * <sites> records to the log.
+  It's off by default, and then the records aren't counted at all
+
+  To select the call sites at runtime give DBG_FILTER the comma separated
+  patterns <file>:<function> of the globs, or @<path> of the file of them.
+  Each site is decided on at its first hit, the others cost one load.
+  RELOAD_DEBUG_FILTER reads it again, and so does SIGHUP with
+  DBG_RELOAD_FILTER_ON_SIGHUP defined:
+
+    DBG_FILTER="conn.cc,parser.cc:Parse*" ./server
+
+  To compile out all the debugging define DBG_COMPILE_OUT. Then dbg(...)
+  evaluates nothing, DERIVE_DEBUG(...) generates nothing and no file is opened:
+
+    #define DBG_COMPILE_OUT
+    #include "dbg.h"
+
+  Type names are taken from the compiler at compile time, so they are the ones
+  of the static types: the object behind a pointer to base is named after base
 */
 
 
 #pragma once
 
+
+// Compile out all the debugging, nothing of the following is left in the binary
+#if defined(DBG_COMPILE_OUT)
+
+#define dbg(...) static_cast<void>(0)
+#define dbg_every_n(n, ...) static_cast<void>(0)
+#define dbg_first_n(n, ...) static_cast<void>(0)
+#define dbg_per_second(k, ...) static_cast<void>(0)
+#define dbg_limit(elements, depth, bytes, ...) static_cast<void>(0)
+#define DERIVE_DEBUG(...)
+#define DISABLE_DEBUG
+#define ENABLE_DEBUG
+#define RELOAD_DEBUG_FILTER
+#define FLUSH_DEBUG_EVERY_RECORD
+#define FLUSH_DEBUG_EVERY_BYTES(n)
+#define FLUSH_DEBUG_EVERY_MS(t)
+#define FLUSH_DEBUG_ON_EXIT
+#define LIMIT_DEBUG(elements, depth, bytes)
+#define dbg_dump() static_cast<void>(0)
+#define dbg_time(...) static_cast<void>(0)
+#define dbg_count(...) static_cast<void>(0)
+#define dbg_hex(...) static_cast<void>(0)
+#define dbg_diff(...) static_cast<void>(0)
+#define dbg_stats(...) static_cast<void>(0)
+
+#else
+
+// The functions and the globals that aren't templates are defined inline right
+// here, so the header may be included into any number of translation units.
+// With DBG_SEPARATE_CORE the functions of the sink and of the summaries are
+// left to dbg.cc instead, that defines DBG_IMPLEMENTATION
+#if !defined(DBG_SEPARATE_CORE)
+#define DBG_DEFINE_CORE
+#define DBG_INLINE inline
+#elif defined(DBG_IMPLEMENTATION)
+#define DBG_DEFINE_CORE
+#define DBG_INLINE
+#endif
+
+#include <algorithm>
 #include <array>
+#include <bit>
+#include <charconv>
+#include <cmath>
 #include <concepts>
+#include <cstdint>
 #include <ctime>
-#include <deque>
-#include <fstream>
-#include <iomanip>
-#include <list>
+#include <iosfwd>
+#include <limits>
 #include <map>
 #include <memory>
 #include <queue>
+#include <ranges>
 #include <set>
-#include <sstream>
 #include <stack>
 #include <string>
 #include <string_view>
 #include <unordered_map>
-#include <unordered_set>
 #include <vector>
 
+// To summarize the huge ranges of numbers on all cores if user wishes so
+#if defined(DBG_PARALLEL_STATS)
+#include <execution>
+#endif
 
-// On GCC and Clang enable the extension abi::__cxa_demangle that demangles
-// user-defined class names. On MSVC class names can be mangled a bit
-#if defined(__GNUC__) || defined(__clang__)
-#define DBG_DEMANGLE_CLASS_NAMES
-#include <cxxabi.h>
+// To dump the bytes 16 at a time where the vector instructions are
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
 #endif
 
 
+// The streams of the sink and the environment are touched by the core only,
+// so with DBG_SEPARATE_CORE they're left to dbg.cc
+#if defined(DBG_DEFINE_CORE)
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#endif
+
 // To write to stdout if user wishes so
-#if defined(DBG_WRITE_TO_STDOUT)
+#if defined(DBG_WRITE_TO_STDOUT) && defined(DBG_DEFINE_CORE)
 #include <iostream>
 #endif
 
+// Records are passed between threads, guard them and time the flushes
+#include <atomic>
+#include <chrono>
+#include <mutex>
+
+// To send the records to the collector if user wishes so. They are sent from
+// the background writer
+#if defined(DBG_WRITE_TO_SOCKET)
+#if defined(DBG_WRITE_TO_STDOUT) || defined(DBG_APPEND_TO_FILE) ||            \
+    defined(DBG_MAPPED_FILE) || defined(DBG_FLIGHT_RECORDER) ||               \
+    defined(DBG_SHARDED_LOG) || defined(DBG_BINARY_LOG)
+#error "DBG_WRITE_TO_SOCKET sends the text records from the background writer"
+#endif
+#if !defined(__linux__)
+#error "DBG_WRITE_TO_SOCKET sends the batches with sendmmsg() of Linux"
+#endif
+#if !defined(DBG_ASYNC)
+#define DBG_ASYNC
+#endif
+#include <sys/socket.h>
+#if defined(DBG_DEFINE_CORE)
+#include <cerrno>
+#include <cstring>
+#include <netdb.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+#endif
+
+// To hand the records to the background writer if user wishes so
+#if defined(DBG_ASYNC)
+#include <condition_variable>
+#include <thread>
+#endif
+
+// To rotate the file if user wishes so
+#if defined(DBG_ROTATE_BYTES) || defined(DBG_ROTATE_SECONDS)
+#if defined(DBG_WRITE_TO_STDOUT) || defined(DBG_MAPPED_FILE) ||              \
+    defined(DBG_FLIGHT_RECORDER) || defined(DBG_BINARY_LOG) ||                \
+    defined(DBG_SHARDED_LOG) || defined(DBG_WRITE_TO_SOCKET)
+#error "Only the text file written through the stream may be rotated"
+#endif
+#if defined(DBG_DEFINE_CORE)
+#include <cstdio>
+#endif
+#endif
+
+// To map the file into the memory if user wishes so
+#if defined(DBG_MAPPED_FILE)
+#if defined(DBG_ASYNC) || defined(DBG_WRITE_TO_STDOUT)
+#error "DBG_MAPPED_FILE is written right by the calling threads into the file"
+#endif
+#if defined(DBG_DEFINE_CORE)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#endif
+
+// To write the records as JSON lines if user wishes so
+#if defined(DBG_JSON_LOG)
+#if defined(DBG_BINARY_LOG)
+#error "DBG_JSON_LOG formats the text the binary log defers to the decoder"
+#endif
+#endif
+
+// To keep the records in the memory until the crash if user wishes so
+#if defined(DBG_FLIGHT_RECORDER)
+#if defined(DBG_ASYNC) || defined(DBG_MAPPED_FILE) || defined(DBG_BINARY_LOG)
+#error "DBG_FLIGHT_RECORDER keeps the text records in the memory of the threads"
+#endif
+#include <csignal>
+#include <exception>
+#if defined(DBG_DEFINE_CORE)
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#endif
+
+// To read DBG_FILTER again on SIGHUP if user wishes so
+#if defined(DBG_RELOAD_FILTER_ON_SIGHUP)
+#include <csignal>
+#endif
+
+// To give each thread its own file if user wishes so
+#if defined(DBG_SHARDED_LOG)
+#if defined(DBG_WRITE_TO_STDOUT) || defined(DBG_ASYNC) ||                    \
+    defined(DBG_MAPPED_FILE) || defined(DBG_FLIGHT_RECORDER) ||               \
+    defined(DBG_BINARY_LOG)
+#error "DBG_SHARDED_LOG is written by the calling threads into their own files"
+#endif
+#if defined(DBG_DEFINE_CORE)
+#include <cstdio>
+#endif
+#endif
+
 
 // Incapsulate logic within this namespace
 namespace __dbg_internal {
 
 // By default, write to clean file "dbg.log"
-#if !defined(DBG_APPEND_FILE) && !defined(DBG_WRITE_TO_STDOUT)
+#if !defined(DBG_APPEND_TO_FILE) && !defined(DBG_WRITE_TO_STDOUT) &&          \
+    !defined(DBG_WRITE_TO_SOCKET)
 #define DBG_WRITE_TO_FILE
 #endif
 
+// Or to "dbg.bin" for the binary log, if user wishes so
+#if defined(DBG_BINARY_LOG)
+inline constexpr const char *kLogFile = "dbg.bin";
+#elif defined(DBG_JSON_LOG)
+inline constexpr const char *kLogFile = "dbg.ndjson";
+#else
+inline constexpr const char *kLogFile = "dbg.log";
+#endif
+
+// The text records are separated by one more \n, the binary entries and the
+// JSON lines need nothing in between
+#if defined(DBG_BINARY_LOG) || defined(DBG_JSON_LOG)
+inline constexpr std::string_view kRecordSeparator = "";
+#else
+inline constexpr std::string_view kRecordSeparator = "\n";
+#endif
+
+#if defined(DBG_MAPPED_FILE)
+// The file sink that is preallocated to the capacity and mapped into the
+// memory. Each record is copied into the region reserved with one atomic add,
+// so there are no write() calls and no lock, and the kernel writes the pages
+// back even if the process crashes. The records that don't fit into the
+// capacity are dropped. The file is cut to the written size on normal exit
+class MappedFile {
+ public:
+  MappedFile(const char *name, bool append, size_t capacity);
+
+  ~MappedFile();
+
+  // Copy the record into the mapping followed by the separator. May be called
+  // from any thread
+  void Write(std::string_view record);
+
+ private:
+  int fd_ = -1;
+  char *data_ = nullptr;
+  // The size of the file before, the records are written after it
+  size_t start_ = 0;
+  size_t capacity_ = 0;
+  // The bytes reserved after start_ and the offset of the first record that
+  // didn't fit, nothing is written after it
+  std::atomic<size_t> used_{0};
+  std::atomic<size_t> full_at_{SIZE_MAX};
+};
+
+// The capacity is set by DBG_MAPPED_FILE_SIZE <bytes>, 64 MiB by default
+#if !defined(DBG_MAPPED_FILE_SIZE)
+#define DBG_MAPPED_FILE_SIZE (size_t{64} << 20)
+#endif
+#if !defined(DBG_DEFINE_CORE)
+// The sink is defined by the core only
+#elif defined(DBG_APPEND_TO_FILE)
+inline MappedFile sink(kLogFile, true, DBG_MAPPED_FILE_SIZE);
+#else
+inline MappedFile sink(kLogFile, false, DBG_MAPPED_FILE_SIZE);
+#endif
+#elif defined(DBG_FLIGHT_RECORDER)
+// The latest records of one thread, framed as seq:u64 size:u32 text where seq
+// orders the records of all threads. The new records overwrite the oldest
+// ones. The owner writes under the mutex, so dbg_dump() may read it at any
+// time. The ring outlives the thread, the next new thread takes it over
+struct Ring {
+  std::mutex mutex;
+  std::unique_ptr<char[]> data;
+  // Bytes ever written, the start of the oldest whole record and the start of
+  // the next one to dump. They only grow, the ring is indexed modulo capacity
+  std::atomic<uint64_t> head{0};
+  std::atomic<uint64_t> tail{0};
+  uint64_t cursor = 0;
+  // Whether some thread writes into it
+  std::atomic<bool> owned{false};
+  // The rings are never freed, so the crash handlers may walk the list
+  Ring *next = nullptr;
+};
+
+// The sink that keeps the records in the rings of the threads and does no
+// I/O until the dump. It's made by dbg_dump(), on SIGSEGV, SIGBUS, SIGFPE,
+// SIGILL and SIGABRT and on std::terminate(), then the previous handlers are
+// called
+class FlightRecorder {
+ public:
+  // Opens the output and installs the handlers
+  FlightRecorder(const char *name, bool append, size_t capacity);
+
+  // Copy the record into the ring of the calling thread. May be called from
+  // any thread
+  void Write(std::string_view record);
+
+  // Write the records of all rings into the output in the order they were
+  // made and forget them. The crash handlers read the rings without the locks
+  void Dump(bool crash);
+
+ private:
+  // The ring the calling thread writes into, it's taken on the first record
+  Ring &ThreadRing();
+
+  // Copy n bytes of the ring starting at the given position
+  void Read(const Ring &ring, uint64_t pos, char *dest, size_t n) const;
+
+  // Write n bytes of the ring starting at the given position to the output
+  void Output(const Ring &ring, uint64_t pos, size_t n);
+
+  static void OnSignal(int signal);
+  static void OnTerminate();
+
+  int fd_ = -1;
+  size_t capacity_;
+  std::atomic<uint64_t> seq_{0};
+  std::atomic<Ring *> rings_{nullptr};
+  std::atomic<bool> crashed_{false};
+  // Touched only by the dumping thread, under dump_mutex_ unless crashed
+  bool dumped_any_ = false;
+  std::mutex dump_mutex_;
+  std::terminate_handler previous_terminate_ = nullptr;
+};
+
+inline constexpr std::array<int, 5> kCrashSignals = {SIGSEGV, SIGBUS, SIGFPE,
+                                                     SIGILL, SIGABRT};
+
+// The handlers of the crash signals the recorder replaced
+inline struct sigaction previous_actions[kCrashSignals.size()];
+
+// The size of the ring of each thread is set by DBG_FLIGHT_RECORDER_SIZE
+// <bytes>, 1 MiB by default
+#if !defined(DBG_FLIGHT_RECORDER_SIZE)
+#define DBG_FLIGHT_RECORDER_SIZE (size_t{1} << 20)
+#endif
+#if !defined(DBG_DEFINE_CORE)
+// The sink is defined by the core only
+#elif defined(DBG_WRITE_TO_STDOUT)
+inline FlightRecorder sink(nullptr, false, DBG_FLIGHT_RECORDER_SIZE);
+#elif defined(DBG_APPEND_TO_FILE)
+inline FlightRecorder sink(kLogFile, true, DBG_FLIGHT_RECORDER_SIZE);
+#else
+inline FlightRecorder sink(kLogFile, false, DBG_FLIGHT_RECORDER_SIZE);
+#endif
+#elif defined(DBG_SHARDED_LOG)
+// Each record in the file of the thread is preceded by the line
+// "#dbg <ns> <seq> <size>": the time of std::chrono::steady_clock it was
+// written at, its number in the file and its size, so tools/dbg_merge.cc may
+// order the records of all files
+inline constexpr std::string_view kShardFrame = "#dbg ";
+
+// The file of one thread, touched only by the thread that owns it. The shard
+// outlives the thread, the next new thread takes it over. Only the core opens
+// the files
+struct Shard;
+#if defined(DBG_DEFINE_CORE)
+struct Shard {
+  std::ofstream file;
+  uint64_t seq = 0;
+  // Bytes written since the last flush and the time of it
+  size_t unflushed_bytes = 0;
+  std::chrono::steady_clock::time_point last_flush;
+  // Whether some thread writes into it
+  std::atomic<bool> owned{false};
+  // The shards are never freed, so the threads writing at exit find theirs
+  Shard *next = nullptr;
+};
+#endif
+
+// The sink that gives each thread its own file, dbg.<n>.log where n counts
+// the files in the order they were opened. The file is opened on the first
+// record of the thread, after that the threads share nothing: no lock, no
+// atomic on the way of the record. Each file is flushed by the policy on its
+// own
+class ShardedFile {
+ public:
+  // Removes the files left by the previous run unless appending to them
+  ShardedFile(const char *name, bool append);
+
+  // Closes the files
+  ~ShardedFile();
+
+  // Write the framed record into the file of the calling thread. May be called
+  // from any thread
+  void Write(std::string_view record);
+
+  // Flush the file of the calling thread, if it has one
+  void Flush();
+
+ private:
+  // The shard the calling thread writes into, it's taken on the first record
+  Shard &ThreadShard();
+
+  // The name of the file with the given number
+  std::string ShardName(uint32_t n) const;
+
+  static void Flush(Shard &shard);
+
+  // It's a plain pointer, so the records made while the thread-locals are
+  // destroyed may still take a shard
+  static inline thread_local Shard *thread_shard_ = nullptr;
+
+  std::string_view name_;
+  bool append_;
+  std::atomic<Shard *> shards_{nullptr};
+  std::atomic<uint32_t> count_{0};
+};
+
+#if !defined(DBG_DEFINE_CORE)
+// The sink is defined by the core only
+#elif defined(DBG_APPEND_TO_FILE)
+inline ShardedFile sink(kLogFile, true);
+#else
+inline ShardedFile sink(kLogFile, false);
+#endif
+#elif defined(DBG_WRITE_TO_SOCKET)
+// The records taken into one sendmmsg() call, at most kSocketBatch of them and
+// kSocketBatchBytes in total. The record longer than kMaxDatagram doesn't fit
+// into the UDP datagram
+inline constexpr size_t kSocketBatch = 64;
+inline constexpr size_t kSocketBatchBytes = size_t{256} << 10;
+inline constexpr size_t kMaxDatagram = 65507;
+
+// The sink that sends each record as one datagram to the collector at the
+// address "udp:<host>:<port>" or "unix:<path>", the socket isn't connected, so
+// the collector may come and go. The socket never blocks: the records it
+// doesn't take right away are dropped and counted, as well as the ones too
+// long for the datagram. Touched only by the background writer
+class SocketSink {
+ public:
+  // Resolves the address. If it's wrong, all the records are dropped
+  explicit SocketSink(const char *address);
+
+  // Sends the rest of the batch and closes the socket
+  ~SocketSink();
+
+  // Add the record to the batch, sending the batch first if it's full
+  void Write(std::string_view record);
+
+  // Send the records of the batch
+  void Send();
+
+  // Add the record of the records dropped since the start to the batch, if
+  // there are new ones since the last such record. Unless forced, it's made
+  // at most once a second, so the collector learns of the drops as they go
+  void ReportDrops(bool forced);
+
+ private:
+  int fd_ = -1;
+  sockaddr_storage address_{};
+  socklen_t address_size_ = 0;
+  // The records of the batch one after another and where each of them ends
+  std::string batch_;
+  std::array<size_t, kSocketBatch> ends_{};
+  size_t count_ = 0;
+  uint64_t reported_drops_ = 0;
+  std::chrono::steady_clock::time_point last_report_{};
+};
+
+#if defined(DBG_DEFINE_CORE)
+inline SocketSink sink(DBG_WRITE_TO_SOCKET);
+#endif
+
+// The records the callers and the sink have dropped since the start. The sink
+// reports them to the collector in the record of its own
+inline std::atomic<uint64_t> dropped_records{0};
+
+// The bytes of the records waiting for the background writer are bounded by
+// DBG_SOCKET_QUEUE_BYTES <n>, 4 MiB by default, the callers drop the records
+// past it, so a slow collector doesn't grow the memory
+#if !defined(DBG_SOCKET_QUEUE_BYTES)
+#define DBG_SOCKET_QUEUE_BYTES (size_t{4} << 20)
+#endif
+#elif defined(DBG_DEFINE_CORE)
+// The binary log is written as is
+#if defined(DBG_BINARY_LOG)
+inline constexpr std::ios_base::openmode kLogMode = std::ios_base::binary;
+#else
+inline constexpr std::ios_base::openmode kLogMode = {};
+#endif
+
 #if defined(DBG_WRITE_TO_FILE)
-std::ofstream out("dbg.log");
+inline std::ofstream sink(kLogFile, kLogMode);
 #endif
 
 // Or append to "dbg.log" if user wishes so
 #if defined(DBG_APPEND_TO_FILE)
-std::ofstream out("dbg.log", std::ios_base::app);
+inline std::ofstream sink(kLogFile, std::ios_base::app | kLogMode);
 #endif
 
 // Or write to stdout if user wishes so
 #if defined(DBG_WRITE_TO_STDOUT)
-auto &out = std::cout;
+inline auto &sink = std::cout;
+#endif
 #endif
 
-// dbg() use it to add one more \n between calls
-bool dbg_was_called = false;
+// The sink use it to add the separator between records. Touched only by the
+// thread that currently owns the sink
+inline bool dbg_was_called = false;
 
 // dbg() use it to determine if it should work at all
-bool dbg_enabled = true;
+inline bool dbg_enabled = true;
+
+
+// How often the sink is flushed. Each policy trades durability of the records
+// for the number of writes
+enum class FlushPolicy {
+  // After each record. A crash loses nothing, but each record costs a write
+  kEveryRecord,
+  // Once the given number of bytes is written since the last flush. A crash
+  // loses at most that many bytes
+  kEveryBytes,
+  // With the first record the given number of milliseconds after the last
+  // flush. A crash loses at most that period of records. Without DBG_ASYNC the
+  // last records wait for the next one or for the exit
+  kEveryMillis,
+  // When the sink is closed on normal exit. A crash loses all the records the
+  // stream still holds, it writes out only when its own buffer is full
+  kOnExit,
+};
 
+// The policy is chosen by DBG_FLUSH_EVERY_BYTES <n>, DBG_FLUSH_EVERY_MS <t> or
+// DBG_FLUSH_ON_EXIT defined before including this file, each record by default.
+// It may be changed by FLUSH_DEBUG_* at any time
+#if defined(DBG_FLUSH_EVERY_BYTES)
+inline std::atomic<FlushPolicy> flush_policy = FlushPolicy::kEveryBytes;
+inline std::atomic<size_t> flush_amount = DBG_FLUSH_EVERY_BYTES;
+#elif defined(DBG_FLUSH_EVERY_MS)
+inline std::atomic<FlushPolicy> flush_policy = FlushPolicy::kEveryMillis;
+inline std::atomic<size_t> flush_amount = DBG_FLUSH_EVERY_MS;
+#elif defined(DBG_FLUSH_ON_EXIT)
+inline std::atomic<FlushPolicy> flush_policy = FlushPolicy::kOnExit;
+inline std::atomic<size_t> flush_amount = 0;
+#else
+inline std::atomic<FlushPolicy> flush_policy = FlushPolicy::kEveryRecord;
+inline std::atomic<size_t> flush_amount = 0;
+#endif
 
-// The current global indentation, PrettyPrint() functions prints it along with
-// the data to make it readable
-std::string indent;
+// Bytes written into the sink and the time of the last flush. Touched only by
+// the thread that currently owns the sink
+inline size_t unflushed_bytes = 0;
+inline std::chrono::steady_clock::time_point last_flush =
+    std::chrono::steady_clock::now();
 
-// Add two spaces to indentation before the new {} block
-void IncreaseIndent();
+// Change the flush policy, amount is in bytes or milliseconds
+void SetFlushPolicy(FlushPolicy policy, size_t amount);
 
-// Erase two spaces from indentation after the {} block
-void DecreaseIndent();
+// Tell if the policy says it's time to flush the output, given the bytes
+// written into it since the last flush made at the given time
+bool FlushDue(size_t unflushed, std::chrono::steady_clock::time_point last);
 
+// Flush the sink if the policy says it's time, given the size of the record
+// just written. Must be called by the only thread that currently owns the sink
+void FlushSinkIfDue(size_t written);
 
-// Tries to print type name, without template parameter types.
-// On GCC and Clang user-defined class names turn out to be correct, thanks to
-// their extension abi::__cxa_demangle. On MSVC class names can be mangled a bit
-template <class T>
-void PrintTypeName(const T &x);
+// Flush the sink now. Must be called by the only thread that currently owns
+// the sink
+void FlushSink();
 
 
-// Prints current time in form of <dd.mm.yy HH:MM:SS>
-void PrintCurrTime();
+#if defined(DBG_ROTATE_BYTES) || defined(DBG_ROTATE_SECONDS)
+// The file is rotated once DBG_ROTATE_BYTES <n> are written into it or it's
+// open for DBG_ROTATE_SECONDS <t>: dbg.log becomes dbg.log.1, the older ones
+// shift up to dbg.log.<DBG_ROTATE_KEEP>, 5 by default, and the oldest one is
+// removed. It's done by the thread that owns the sink, with DBG_ASYNC it's the
+// background writer
+#if !defined(DBG_ROTATE_KEEP)
+#define DBG_ROTATE_KEEP 5
+#endif
 
+// Bytes written into the file and the time it was opened at. Touched only by
+// the thread that currently owns the sink
+#if defined(DBG_DEFINE_CORE)
+#if defined(DBG_APPEND_TO_FILE)
+inline size_t sink_bytes = std::max<std::streamoff>(
+    std::ifstream(kLogFile, std::ios_base::ate | std::ios_base::binary).tellg(),
+    0);
+#else
+inline size_t sink_bytes = 0;
+#endif
+inline std::chrono::steady_clock::time_point sink_opened =
+    std::chrono::steady_clock::now();
+#endif
 
-// Distiguish scalar types like int, float or char
-template <class T>
-concept is_scalar = std::is_scalar_v<T>;
+// Rotate the file if it's time, given the size of the record just written.
+// Must be called by the only thread that currently owns the sink
+void RotateSinkIfDue(size_t written);
 
-// Distinguish class types, regardless from std or user-defined
-template <class T>
-concept is_class = std::is_class_v<T>;
+// Rotate the file now and start the new one. Must be called by the only thread
+// that currently owns the sink
+void RotateSink();
+#endif
 
 
-// Print scalar type like int, float or char
-template <class T>
-  requires is_scalar<T>
-void PrettyPrint(T x);
+// How much of the data a record may show, 0 means no limit. Enforced right in
+// the PrettyPrint() functions, so whatever doesn't fit isn't even visited
+struct Limits {
+  // Containers longer than twice this show that many elements from each end
+  // and the count of the skipped ones in between
+  size_t elements = 0;
+  // {} blocks nested deeper than this show {...} instead of the contents
+  int depth = 0;
+  // The record stops showing the data once it's that long
+  size_t bytes = 0;
+
+  // Take the limits that aren't set here from the given ones
+  Limits Or(const Limits &other) const {
+    return {elements ? elements : other.elements, depth ? depth : other.depth,
+            bytes ? bytes : other.bytes};
+  }
+};
 
-// Print any class object, that isn't overloaded later
-// Note that class must generate PrettyPrint method using DERIVE_DEBUG macro
-template <class T>
-  requires is_class<T>
-void PrettyPrint(const T &x);
+// The limits of all records are set by DBG_MAX_ELEMENTS <n>, DBG_MAX_DEPTH <n>
+// and DBG_MAX_RECORD_BYTES <n> defined before including this file, no limits
+// by default. They may be changed by LIMIT_DEBUG at any time
+#if !defined(DBG_MAX_ELEMENTS)
+#define DBG_MAX_ELEMENTS 0
+#endif
+#if !defined(DBG_MAX_DEPTH)
+#define DBG_MAX_DEPTH 0
+#endif
+#if !defined(DBG_MAX_RECORD_BYTES)
+#define DBG_MAX_RECORD_BYTES 0
+#endif
+inline std::atomic<size_t> limit_elements = DBG_MAX_ELEMENTS;
+inline std::atomic<int> limit_depth = DBG_MAX_DEPTH;
+inline std::atomic<size_t> limit_bytes = DBG_MAX_RECORD_BYTES;
 
+// Change the limits of all records
+void SetLimits(const Limits &limits);
 
-// Print what's behind std::ref
-template <class T>
-void PrettyPrint(std::reference_wrapper<T> x);
+// The limits of all records
+Limits GlobalLimits();
 
 
-// Print std::pair of two scalars
-template <class F, class S>
-  requires is_scalar<F> && is_scalar<S>
-void PrettyPrint(const std::pair<F, S> &x);
+// Collects the text of the record being printed on the current thread.
+// It never writes anything by itself, the storage is kept between records
+class RecordBuffer : public std::streambuf {
+ public:
+  std::string_view View() const {
+    return data_;
+  }
 
-// Print std::pair where at least one element is class object
-template <class F, class S>
-  requires is_class<F> || is_class<S>
-void PrettyPrint(const std::pair<F, S> &x);
+  void Clear() {
+    data_.clear();
+  }
 
+  // Append the chars formatted elsewhere, bypassing the stream
+  void Append(const char *s, size_t n) {
+    data_.append(s, n);
+  }
 
-// Print std::string
-void PrettyPrint(const std::string &x);
+  // Make room for n more chars, so appending them doesn't reallocate
+  void Reserve(size_t n) {
+    data_.reserve(data_.size() + n);
+  }
 
-// Print std::string_view
-void PrettyPrint(const std::string_view &x);
+  // Replace n chars at the given position, they must be already appended
+  void Overwrite(size_t pos, const char *s, size_t n) {
+    data_.replace(pos, n, s, n);
+  }
 
-// Print std::stringstream contents
-void PrettyPrint(const std::stringstream &x);
+  // Move n chars from the position from back to the position to, over the
+  // ones cut out in between
+  void MoveBack(size_t to, size_t from, size_t n) {
+    std::copy_n(data_.begin() + from, n, data_.begin() + to);
+  }
 
+  // Drop the chars past the given size
+  void Truncate(size_t size) {
+    data_.resize(size);
+  }
 
-// Print std::array of scalars
-template <class T, size_t N>
-  requires is_scalar<T>
-void PrettyPrint(const std::array<T, N> &x);
+ protected:
+  int_type overflow(int_type c) override {
+    if (!traits_type::eq_int_type(c, traits_type::eof())) {
+      data_.push_back(traits_type::to_char_type(c));
+    }
+    return traits_type::not_eof(c);
+  }
 
-// Print std::array of class objects
-template <class T, size_t N>
-  requires is_class<T>
-void PrettyPrint(const std::array<T, N> &x);
+  std::streamsize xsputn(const char *s, std::streamsize n) override {
+    data_.append(s, n);
+    return n;
+  }
 
+ private:
+  std::string data_;
+};
 
-// Print std::vector of scalars
-template <class T>
-  requires is_scalar<T>
-void PrettyPrint(const std::vector<T> &x);
+// Static run of spaces the indentation is written from
+inline constexpr std::string_view kSpaces =
+    "                                                                ";
 
-// Print std::vector of class objects
-template <class T>
-  requires is_class<T>
-void PrettyPrint(const std::vector<T> &x);
+// Indentation of the {} block of the given depth, two spaces per level
+struct Indentation {
+  int depth;
+};
 
+std::ostream &operator<<(std::ostream &out, Indentation indent);
 
-// Print std::deque of scalars
-template <class T>
-  requires is_scalar<T>
-void PrettyPrint(const std::deque<T> &x);
+// No span of dbg_diff(), e.g. the parent of the argument
+inline constexpr size_t kNoSpan = SIZE_MAX;
 
-// Print std::deque of class objects
-template <class T>
-  requires is_class<T>
-void PrettyPrint(const std::deque<T> &x);
+// The text of the value the record of dbg_diff() compares with the last one
+// of its call site. The path is the hash of the ids of the value and of the
+// ones enclosing it, the hash is the one of its text
+struct DiffSpan {
+  size_t begin = 0;
+  size_t end = 0;
+  size_t parent = kNoSpan;
+  uint64_t path = 0;
+  uint64_t hash = 0;
 
+  // Whether the value differs from the last time and shows in the record
+  bool changed = false;
+  bool shown = false;
+};
 
-// Print std::queue of scalars
+// The address unique to the type, it tells apart the objects of different
+// types at the same address, e.g. a class and its first member
 template <class T>
-  requires is_scalar<T>
-void PrettyPrint(std::queue<T> x);
+inline constexpr char kTypeTag = 0;
 
-// Print std::queue of class objects
-template <class T>
-  requires is_class<T> && std::is_copy_constructible_v<T>
-void PrettyPrint(std::queue<T> x);
+// The set of addresses of one record along with the tags of their types,
+// hashed with linear probing. Clearing it only starts the new generation, so
+// it keeps the slots and the records made in steady state allocate nothing
+class AddressSet {
+ public:
+  // Returns false if the address of the type is already in the set
+  bool Insert(const void *address, const void *type);
 
+  void Clear() {
+    size_ = 0;
+    ++generation_;
+  }
 
-// Print std::stack of scalars
-template <class T>
-  requires is_scalar<T>
-void PrettyPrint(std::stack<T> x);
+ private:
+  // The slot holds the address if it's of the current generation
+  struct Slot {
+    const void *address = nullptr;
+    const void *type = nullptr;
+    uint64_t generation = 0;
+  };
+
+  std::vector<Slot> slots_;
+  size_t size_ = 0;
+  uint64_t generation_ = 1;
+};
 
-// Print std::stack of class objects
-template <class T>
-  requires is_class<T> && std::is_copy_constructible_v<T>
-void PrettyPrint(std::stack<T> x);
+// Everything PrettyPrint() functions need to render a record: the buffer it's
+// collected in, the stream writing into it and the depth of the current {}
+// block. Each thread renders its records in its own context
+struct Context {
+  RecordBuffer buffer;
+  std::ostream out{&buffer};
+  int depth = 0;
+
+  // The limits of the current record and whether it has hit the size one
+  Limits limits;
+  bool truncated = false;
+
+  // Whether the record is the one of dbg_diff(), the spans of the values it
+  // compares, in the order they are printed, and the innermost open one
+  bool diffing = false;
+  std::vector<DiffSpan> diff_spans;
+  size_t diff_open = kNoSpan;
+
+  // The class objects behind the shared pointers already printed in the
+  // record
+  AddressSet pointees;
+
+  // The second the formatted time of the records was made for, it's refreshed
+  // only when the second changes
+  std::time_t time_second = -1;
+  std::array<char, 17> time_text{};
+
+  // When the current record was begun, its formatting is counted from here
+  // into the usage of the call site
+  std::chrono::steady_clock::time_point began;
+
+  // The indentation PrettyPrint() functions print along with the data to make
+  // it readable
+  Indentation Indent() const {
+    return {depth};
+  }
 
+  // Add one level of indentation before the new {} block
+  void IncreaseIndent() {
+    ++depth;
+  }
 
-// Print std::list of scalars
-template <class T>
-  requires is_scalar<T>
-void PrettyPrint(const std::list<T> &x);
+  // Remove one level of indentation after the {} block
+  void DecreaseIndent() {
+    --depth;
+  }
 
-// Print std::list of class objects
-template <class T>
-  requires is_class<T>
-void PrettyPrint(const std::list<T> &x);
+  // Tell if the new {} block would be nested too deep to show its contents
+  bool TooDeep() const {
+    return limits.depth != 0 && depth >= limits.depth;
+  }
 
+  // Tell if the record is too long to show more data. The first time says so
+  // in the record, on its own line or right in the current one
+  bool Exhausted(bool own_line);
+};
 
-// Print std::set of scalars
-template <class T>
-  requires is_scalar<T>
-void PrettyPrint(const std::set<T> &x);
+// The context of the current thread
+inline thread_local Context context;
+
+// Whether the context of the current thread is yet to be made, may be used or
+// is already destroyed along with the other thread-locals of the thread
+enum class ContextState : uint8_t {
+  kUnborn,
+  kAlive,
+  kDestroyed,
+};
+inline thread_local ContextState context_state = ContextState::kUnborn;
+
+// Made right after the context of the thread, so it's destroyed right before
+// it and tells the records made later, e.g. by the static destructors or the
+// atexit() handlers, to take the late context instead
+struct ContextGuard {
+  ContextGuard() {
+    static_cast<void>(context.depth);
+    context_state = ContextState::kAlive;
+  }
+
+  ~ContextGuard() {
+    context_state = ContextState::kDestroyed;
+  }
+
+  // Make the guard and the context of the thread if they aren't yet
+  void Touch() {
+  }
+};
+inline thread_local ContextGuard context_guard;
+
+// The context of the records made on the threads whose own one is destroyed.
+// It's made on the first of them, never destroyed, and taken by one record at
+// a time under the mutex from BeginRecord() to CommitRecord() or DropRecord()
+inline std::recursive_mutex late_context_mutex;
+inline Context *late_context = nullptr;
+
+
+// Write the finished record into the sink, prepending the separator, and flush
+// it as the policy says. Must be called by the only thread that currently owns
+// the sink
+void WriteToSink(std::string_view text);
+
+// The object one thread keeps at one call site, e.g. the histogram of
+// dbg_time(), or the nodes of its records with DBG_ASYNC. It's written by the
+// owner only, and once the owner exits it's handed to the next thread that
+// needs one, which carries on its figures
+struct Leasable {
+  std::atomic<bool> owned{false};
+};
+
+// Where the thread keeps the object it took at the call site. It's cleared
+// when the thread gives the object back, so what the destructors of the
+// thread-locals do after that takes an object again and keeps it
+struct LeaseSlot {
+  Leasable *item = nullptr;
+};
+
+// The objects the thread took, given back when it exits
+class ThreadLeases {
+ public:
+  ~ThreadLeases();
 
-// Print std::set of class objects
+  void Add(LeaseSlot &slot) {
+    slots_.push_back(&slot);
+  }
+
+ private:
+  std::vector<LeaseSlot *> slots_;
+};
+
+inline thread_local ThreadLeases thread_leases;
+// Set once thread_leases is destroyed, the objects taken after aren't listed
+inline thread_local bool thread_leases_gone = false;
+
+// Put the object into the slot and list it among the ones the thread gives
+// back on exit
+void HoldLease(LeaseSlot &slot, Leasable &item);
+
+// The objects the threads took at one call site, one per thread. A new one is
+// made only if none is given back. They are never freed, so the report may
+// walk the list at any time
 template <class T>
-  requires is_class<T>
-void PrettyPrint(const std::set<T> &x);
+class LeasedList {
+ public:
+  T *Head() const {
+    return head_.load(std::memory_order_acquire);
+  }
+
+  // Take the object for the calling thread into the slot
+  T &Take(LeaseSlot &slot);
+
+ private:
+  std::atomic<T *> head_{nullptr};
+};
+
+#if defined(DBG_ASYNC)
+struct NodePool;
+
+// The finished record on its way to the background writer
+struct RecordNode {
+  std::atomic<RecordNode *> next{nullptr};
+  std::string text;
+  // Where the node goes back once it's written
+  NodePool *pool = nullptr;
+};
+
+// Each thread has DBG_ASYNC_NODES <n> nodes, 256 by default, made on its first
+// record with DBG_ASYNC_NODE_BYTES <n> of the text each, 1 KiB by default. The
+// text of the longer record grows its node once. When all the nodes of the
+// thread wait for the writer, the next record waits until one is written
+#if !defined(DBG_ASYNC_NODES)
+#define DBG_ASYNC_NODES 256
+#endif
+#if !defined(DBG_ASYNC_NODE_BYTES)
+#define DBG_ASYNC_NODE_BYTES 1024
+#endif
+
+// The text of the written node that has grown past this is given back to the
+// heap, so one huge record doesn't keep its memory
+inline constexpr size_t kMaxRecycledText = size_t{64} << 10;
+
+// The nodes of one thread. The writer gives the written ones back one by one,
+// the owner takes all of them at once, so the stack has no ABA problem. Once
+// the thread exits its nodes serve the next new one
+struct NodePool : Leasable {
+  // Makes the nodes of the thread
+  NodePool();
+
+  // The nodes the writer gave back
+  std::atomic<RecordNode *> free{nullptr};
+  // The nodes the owner took and didn't use yet
+  RecordNode *taken = nullptr;
+  NodePool *next = nullptr;
+};
+
+// Lock-free intrusive multi-producer single-consumer queue by D. Vyukov.
+// Push() is wait-free and may be called from any thread, Pop() must be called
+// from the single consumer only
+class MpscQueue {
+ public:
+  MpscQueue() : head_(&stub_), tail_(&stub_) {
+  }
+
+  void Push(RecordNode *node);
+
+  // Returns nullptr if the queue is empty or the only pushed node isn't
+  // linked yet
+  RecordNode *Pop();
+
+ private:
+  std::atomic<RecordNode *> head_;
+  RecordNode *tail_;
+  RecordNode stub_;
+};
+
+// Background thread that drains the queue into the sink. Sleeps while there
+// is nothing to write, so producers take the lock only to wake it up
+class AsyncWriter {
+ public:
+  AsyncWriter();
+
+  // Writes the remaining records and joins the thread
+  ~AsyncWriter();
+
+  void Push(RecordNode *node);
+
+  // Take the node for the next record from the pool of the calling thread,
+  // waiting for the writer if all of them are queued. Its text is empty but
+  // keeps the capacity
+  RecordNode *Node();
+
+#if defined(DBG_WRITE_TO_SOCKET)
+  // Count the bytes of the record about to be pushed, unless they would take
+  // the queue past DBG_SOCKET_QUEUE_BYTES
+  bool Admit(size_t bytes);
+#endif
+
+ private:
+  void Run();
+
+  // Write the popped node into the sink and give it back to its pool.
+  // Must be called by the owner of the sink only
+  void Write(RecordNode *node);
+
+  // Give the written node back to the pool of its thread
+  static void Recycle(RecordNode *node);
+
+  MpscQueue queue_;
+  LeasedList<NodePool> pools_{};
+#if defined(DBG_WRITE_TO_SOCKET)
+  // The bytes of the records admitted and not written yet
+  std::atomic<size_t> queued_bytes_{0};
+#endif
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  std::atomic<bool> idle_{false};
+  std::atomic<bool> stop_{false};
+  std::thread thread_;
+};
+
+// Must be constructed after the sink, so it is destroyed before. Both are
+// defined by the core only, so with DBG_SEPARATE_CORE dbg.cc keeps the order
+#if defined(DBG_DEFINE_CORE)
+inline AsyncWriter async_writer;
+#endif
+#elif !defined(DBG_MAPPED_FILE) && !defined(DBG_FLIGHT_RECORDER) &&       \
+    !defined(DBG_SHARDED_LOG)
+// Serializes the threads writing their records into the sink
+inline std::mutex sink_mutex;
+#endif
+
+// What the filter of the call sites decided on the site
+enum class FilterDecision : uint8_t {
+  kUndecided,
+  kRejected,
+  kSelected,
+};
+
+// The records one thread made at one call site, the bytes of them and the
+// nanoseconds spent formatting them. It's written by the only thread that owns
+// it with relaxed stores and read by the report at any time. It's leased like
+// the histograms of dbg_time()
+struct SiteUsage : Leasable {
+  std::atomic<uint64_t> records{0};
+  std::atomic<uint64_t> bytes{0};
+  std::atomic<uint64_t> format_ns{0};
+  SiteUsage *next = nullptr;
+
+  // Count the record. Must be called by the owner only
+  void Add(uint64_t record_bytes, uint64_t ns);
+};
+
+// Static descriptor of the dbg() call site, each expansion of dbg() has its
+// own. The checks are made on relaxed atomics before any argument is evaluated
+struct CallSite {
+  const char *file;
+  int line;
+  const char *func;
+
+  // Hits of the sampled dbg_* variants
+  std::atomic<uint64_t> hits{0};
+
+  // The second of steady_clock the current window of dbg_per_second started
+  // at and the records made within it
+  std::atomic<int64_t> window{0};
+  std::atomic<uint64_t> window_records{0};
+
+#if defined(DBG_BINARY_LOG)
+  // Id of the site in the binary log, 0 until its entry is written
+  std::atomic<uint32_t> binary_id{0};
+  // The copy of the site its usage is reported at, made by the first report
+  CallSite *usage_site = nullptr;
+#endif
+
+  // What DBG_FILTER decided on the site, reset when the filter is reloaded
+  std::atomic<FilterDecision> filter_decision{FilterDecision::kUndecided};
+  // The next site in the list of the decided ones, set under filter_mutex
+  CallSite *next_decided = nullptr;
+  bool decided_once = false;
+
+  // The usages of the threads that made the records of the site
+  LeasedList<SiteUsage> usages{};
+  std::atomic<bool> accounted{false};
+  CallSite *next_accounted = nullptr;
+
+  // The usage of the calling thread kept in the slot, it's taken on its first
+  // record
+  SiteUsage &ThreadUsage(LeaseSlot &slot);
+
+  // Take the usage into the slot and list the site among the accounted
+  SiteUsage &TakeUsage(LeaseSlot &slot);
+
+  // Tell if the site is selected by DBG_FILTER. It's decided on the first hit
+  // and after each reload, the other hits cost a single load
+  bool Selected();
+
+  // Decide on the site with the current filter, reading it first if stale
+  bool DecideFilter();
+
+  // Count the hit and tell if it's the first one or the n-th since the last
+  // recorded
+  bool EveryNth(uint64_t n);
+
+  // Count the hit and tell if it's one of the first n. Once they are recorded
+  // the hits aren't counted, so the check is a single load
+  bool FirstN(uint64_t n);
+
+  // Tell if less than k records were made within the current second
+  bool PerSecond(uint64_t k);
+};
+
+// Tell if the glob of * and ? matches the whole text
+bool MatchGlob(std::string_view glob, std::string_view text);
+
+// The filter of the call sites given by DBG_FILTER as the comma separated
+// patterns <file>:<function> of the globs, "net/*.cc:*,parser.cc:Parse*". The
+// file glob matches __FILE__ or its part after any /, the function one
+// __func__, and the pattern without : matches all functions of the files.
+// DBG_FILTER=@<path> reads the patterns from the file, where the line breaks
+// separate them too. Without DBG_FILTER all the sites are selected, with the
+// empty or unreadable one none
+class SiteFilter {
+ public:
+  // Select all the sites
+  SiteFilter() = default;
+
+  explicit SiteFilter(std::string_view patterns);
+
+  // Read the patterns of DBG_FILTER
+  static SiteFilter FromEnvironment();
+
+  bool Selects(std::string_view file, std::string_view func) const;
+
+ private:
+  struct Pattern {
+    std::string file;
+    std::string func;
+  };
+
+  bool select_all_ = true;
+  std::vector<Pattern> patterns_;
+};
+
+// The decisions are made and the filter is read under the mutex, the first
+// one reads DBG_FILTER. The stale filter is read again before the next one
+inline std::mutex filter_mutex;
+inline SiteFilter site_filter;
+inline std::atomic<bool> filter_stale{true};
+
+// The sites that were decided at least once, in the reverse order
+inline std::atomic<CallSite *> decided_sites{nullptr};
+
+// The sites that made at least one record, in the reverse order
+inline std::atomic<CallSite *> accounted_sites{nullptr};
+
+// Make the filter read DBG_FILTER again and decide on each site once more on
+// its next hit. Takes no lock, so it's called by the handler of SIGHUP too
+void ReloadFilter();
+
+#if defined(DBG_RELOAD_FILTER_ON_SIGHUP)
+// Call ReloadFilter() on SIGHUP, the handler is set before main()
+bool ReloadFilterOnSighup();
+inline const bool reloads_filter_on_sighup = ReloadFilterOnSighup();
+#endif
+
+// Start the record in the context of the current thread with the header of
+// the writer, [<file>:<line> (<function>) <date> <time>] for the text one.
+// The limits that aren't set are taken from the global ones. The binary log
+// has the header written by RecordArgs() instead
+Context &BeginRecord(const CallSite &site, const Limits &limits);
+
+// Start the record in the given context, for the records that aren't made by
+// dbg() on the current thread
+void BeginRecord(Context &ctx, const CallSite &site, const Limits &limits);
+
+// Let the writer end the record collected in the context, pass it to the sink
+// and clear the buffer. dbg() calls it once the record is complete
+void CommitRecord(Context &ctx);
+
+// CommitRecord() that counts the record, its bytes and the time since it was
+// begun into the usage of the call site the thread keeps in the slot. Nothing
+// is counted with DBG_USAGE_TOP 0
+void CommitRecord(Context &ctx, CallSite &site, LeaseSlot &usage);
+
+// Forget the record begun in the context without passing it to the sink.
+// dbg_diff() calls it when nothing changed
+void DropRecord(Context &ctx);
+
+// Pass the finished record to the sink, through the background writer with
+// DBG_ASYNC or right from the calling thread
+void PassToSink(std::string_view record);
+
+// Write out what's kept in the memory: the rings of the flight recorder or
+// whatever the sink holds. dbg_dump() calls it
+void Dump();
+
+
+// Log-linear histogram of the durations in nanoseconds: the values below 16
+// have their own buckets, each power of two above is split into 16 buckets,
+// so a bucket is at most 1/16 of its values wide. It's written by the only
+// thread that owns it with relaxed stores and read by the others at any time
+struct TimeHistogram : Leasable {
+  static constexpr int kSubBits = 4;
+  static constexpr size_t kSubBuckets = size_t{1} << kSubBits;
+  static constexpr size_t kBuckets = (64 - kSubBits + 1) * kSubBuckets;
+
+  std::array<std::atomic<uint64_t>, kBuckets> counts{};
+  std::atomic<uint64_t> max{0};
+  TimeHistogram *next = nullptr;
+
+  // Count the duration. Must be called by the owner only
+  void Add(uint64_t ns);
+
+  // The bucket of the duration and the middle of the durations it holds
+  static size_t Bucket(uint64_t ns);
+  static uint64_t BucketMiddle(size_t bucket);
+};
+
+// Static descriptor of the dbg_time() call site. Each thread times it into
+// its own histogram, they are merged only by the report
+struct TimedSite {
+  CallSite site;
+  // The label dbg_time() was called with, empty if none
+  std::string_view label;
+  LeasedList<TimeHistogram> histograms{};
+  std::atomic<bool> registered{false};
+  TimedSite *next = nullptr;
+
+  // The histogram of the calling thread kept in the slot, it's taken on the
+  // first hit
+  TimeHistogram &ThreadHistogram(LeaseSlot &slot);
+
+  // Take the histogram into the slot and list the site among the reported
+  TimeHistogram &TakeHistogram(LeaseSlot &slot);
+};
+
+// The sites that were hit at least once, in the reverse order
+inline std::atomic<TimedSite *> timed_sites{nullptr};
+
+// Times the scope it lives in with steady_clock into the histogram
+class ScopeTimer {
+ public:
+  // Times nothing unless the site is selected by DBG_FILTER
+  ScopeTimer(TimeHistogram &histogram, CallSite &site);
+
+  ~ScopeTimer();
+
+ private:
+  TimeHistogram &histogram_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+// Make the record of the counts and the quantiles of each dbg_time() site,
+// merged across the threads. The figures are the ones since the start
+void ReportTimes(Context &ctx);
+
+
+// The key of dbg_count() called without the value
+struct NoKey {};
+
+// The counts of the small non-negative integral values, enums and bool are
+// kept in the array, the others in the map
+inline constexpr size_t kDenseCounts = 64;
+
+// The counters never share the cache line with the ones of the other threads
+inline constexpr size_t kCacheLine = 64;
+
+// The order of the values dbg_count() counts by. NaN isn't less or greater
+// than anything, that would break the order of the map, so all of them are
+// one key after the numbers
+struct CountKeyLess {
+  template <class T>
+  bool operator()(const T &a, const T &b) const {
+    if constexpr (std::is_floating_point_v<T>) {
+      if (std::isnan(a) || std::isnan(b)) {
+        return !std::isnan(a);
+      }
+    }
+    return a < b;
+  }
+};
+
+template <class T>
+using CountMap = std::map<T, uint64_t, CountKeyLess>;
+
+// The hits of one dbg_count() site made by one thread, by the value of the
+// argument. Only the owner writes, the dense counters with relaxed stores and
+// the map under the mutex that the report takes as well
+template <class T>
+struct alignas(kCacheLine) CountShard : Leasable {
+  std::array<std::atomic<uint64_t>, kDenseCounts> dense{};
+  std::mutex mutex;
+  CountMap<T> sparse;
+  CountShard *next = nullptr;
+
+  // Count the hit with the value. Must be called by the owner only
+  void Add(T x);
+};
+
+// The hits of one dbg_count() site without the value made by one thread
+template <>
+struct alignas(kCacheLine) CountShard<NoKey> : Leasable {
+  std::atomic<uint64_t> count{0};
+  CountShard *next = nullptr;
+
+  // Count the hit. Must be called by the owner only
+  void Add();
+};
+
+// Static descriptor of the dbg_count() call site, regardless of the key
+class CountedSiteBase {
+ public:
+  CountedSiteBase(const char *file, int line, const char *func,
+                  std::string_view expression)
+      : site_{file, line, func}, expression_(expression) {
+  }
+
+  // Make the record of the counts merged across the threads
+  virtual void Report(Context &ctx) = 0;
+
+  CountedSiteBase *Next() const {
+    return next_;
+  }
+
+  // Tell if the site is selected by DBG_FILTER
+  bool Selected() {
+    return site_.Selected();
+  }
+
+ protected:
+  // Put the site into the list of the reported ones, once
+  void Register();
+
+  CallSite site_;
+  // The argument dbg_count() was called with, empty if none
+  std::string_view expression_;
+
+ private:
+  std::atomic<bool> registered_{false};
+  CountedSiteBase *next_ = nullptr;
+};
+
+// The sites that were hit at least once, in the reverse order
+inline std::atomic<CountedSiteBase *> counted_sites{nullptr};
+
+// Static descriptor of the dbg_count() call site. Each thread counts into its
+// own shard, they are merged only by the report
+template <class T>
+class CountedSite : public CountedSiteBase {
+  static_assert(std::same_as<T, NoKey> || std::is_scalar_v<T>,
+                "dbg_count() counts the values of a scalar");
+
+ public:
+  using CountedSiteBase::CountedSiteBase;
+
+  // The shard of the calling thread kept in the slot, it's taken on the first
+  // hit
+  CountShard<T> &ThreadShard(LeaseSlot &slot);
+
+  void Report(Context &ctx) override;
+
+ private:
+  // Take the shard into the slot and list the site among the reported
+  CountShard<T> &TakeShard(LeaseSlot &slot);
+
+  LeasedList<CountShard<T>> shards_{};
+};
+
+// The key type of dbg_count() called with the given argument, if any, taken
+// with decltype(), so the argument isn't evaluated twice
+NoKey CountKeyOf();
+
+template <class T>
+std::decay_t<T> CountKeyOf(const T &);
+
+// Make the record of the counts of each dbg_count() site, merged across the
+// threads. The figures are the ones since the start
+void ReportCounts(Context &ctx);
+
+
+// The number of the call sites in each table of ReportUsage(), 0 turns the
+// report and the counting off. It's set by DBG_USAGE_TOP <sites>, 0 by default
+#if !defined(DBG_USAGE_TOP)
+#define DBG_USAGE_TOP 0
+#endif
+
+// Make the records of the call sites that made the most bytes and of the ones
+// that spent the most time formatting, DBG_USAGE_TOP of each, merged across
+// the threads. The figures are the ones since the start
+void ReportUsage(Context &ctx);
+
+
+// Make the records of dbg_time(), dbg_count() and the usage of the call sites.
+// dbg_dump() calls it
+void ReportSummaries();
+
+// Reports the summaries on normal exit, before the sink is closed. The flight
+// recorder writes out only on crash or dbg_dump(), so it's not reported into
+struct SummariesAtExit {
+  ~SummariesAtExit();
+};
+
+
+// Static descriptor of the dbg_diff() call site with the hashes of the values
+// its last record was compared by, sorted by their paths. The records of the
+// site are made one at a time
+struct DiffSite {
+  CallSite site;
+  std::mutex mutex{};
+  std::vector<std::pair<uint64_t, uint64_t>> hashes{};
+
+  // Where the hashes of the current record are collected
+  std::vector<std::pair<uint64_t, uint64_t>> next_hashes{};
+};
+
+// Marks the value the record of dbg_diff() compares with the last one of its
+// call site: the argument, the field, the class element or the map entry. The
+// id tells it from the other values of its block. Does nothing in the other
+// records. The value that isn't marked is compared only as a part of its
+// parent, along with the ones within it
+class DiffScope {
+ public:
+  DiffScope(Context &ctx, uint64_t id, bool marked = true);
+
+  // The value identified by its name, e.g. the argument or the field. The name
+  // is hashed only in the records of dbg_diff()
+  DiffScope(Context &ctx, std::string_view name);
+
+  ~DiffScope();
+
+  // Identify the value by its key instead, printed since the given position
+  void IdentifyByKey(size_t key_begin);
+
+ private:
+  // Start the span of the value in the record of dbg_diff()
+  void Open(uint64_t id, bool marked);
+
+  Context &ctx_;
+  size_t span_ = kNoSpan;
+  bool hidden_ = false;
+};
+
+// Hash of the pair of hashes, the path of the value within its parent
+constexpr uint64_t CombineHashes(uint64_t parent, uint64_t id);
+
+// Compare the spans of the record with the last ones of the site and cut out
+// the unchanged values whose parents are shown, the binary log keeps all of
+// them. The hashes of the site become the ones of the record. Returns false if
+// none of the arguments changed
+bool LeaveOutUnchanged(Context &ctx, DiffSite &site);
+
+
+// Type name as the compiler spells it in the signature of this very function,
+// template parameter types included
+template <class T>
+constexpr std::string_view RawTypeName() {
+#if defined(_MSC_VER) && !defined(__clang__)
+  // ... __cdecl __dbg_internal::RawTypeName<T>(void)
+  std::string_view signature = __FUNCSIG__;
+  size_t begin = signature.find("RawTypeName<") + 12;
+  size_t end = signature.rfind(">(void)");
+#else
+  // ... __dbg_internal::RawTypeName() [with T = T; ...] on GCC
+  // ... __dbg_internal::RawTypeName() [T = T] on Clang
+  std::string_view signature = __PRETTY_FUNCTION__;
+  size_t begin = signature.find("T = ") + 4;
+  size_t end = signature.find(';', begin);
+  if (end == std::string_view::npos) {
+    end = signature.size() - 1;
+  }
+#endif
+  return signature.substr(begin, end - begin);
+}
+
+// Type name that fits into N chars, stored right in the binary
+template <size_t N>
+struct StaticTypeName {
+  std::array<char, N> data{};
+  size_t size = 0;
+};
+
+// Drops template parameter types, compiler specific inline namespaces and
+// MSVC class-key prefixes, then makes weird std names more readable
+template <size_t N>
+constexpr StaticTypeName<N> SimplifyTypeName(std::string_view raw) {
+  raw = raw.substr(0, raw.find('<'));
+  for (std::string_view key : {"class ", "struct ", "union ", "enum "}) {
+    if (raw.starts_with(key)) {
+      raw.remove_prefix(key.size());
+    }
+  }
+
+  StaticTypeName<N> name;
+  for (size_t i = 0; i < raw.size();) {
+    std::string_view rest = raw.substr(i);
+    if (rest.starts_with("__cxx11::") || rest.starts_with("__1::")) {
+      i += rest.find("::") + 2;
+      continue;
+    }
+    name.data[name.size++] = raw[i++];
+  }
+
+  std::string_view simplified(name.data.data(), name.size);
+  if (simplified == "std::basic_string") {
+    name = {};
+    for (char c : std::string_view("std::string")) {
+      name.data[name.size++] = c;
+    }
+  }
+  return name;
+}
+
+// Simplified type name is computed once per type, at compile time
+template <class T>
+inline constexpr auto static_type_name =
+    SimplifyTypeName<RawTypeName<T>().size() + 1>(RawTypeName<T>());
+
+// Type name, without template parameter types
+template <class T>
+constexpr std::string_view TypeName() {
+  return {static_type_name<T>.data.data(), static_type_name<T>.size};
+}
+
+// Prints current time in form of <dd.mm.yy HH:MM:SS>. The text is cached per
+// thread and refreshed when the second changes.
+// With DBG_MONOTONIC_TIME defined prints <seconds>.<nanoseconds> of
+// steady_clock instead, the same clock tracing spans are stamped with
+void PrintCurrTime(Context &ctx);
+
+
+// Distiguish scalar types like int, float or char
+template <class T>
+concept is_scalar = std::is_scalar_v<T>;
+
+// Distinguish the types the stream prints, the scoped enums are printed as
+// their underlying values unless there's operator<< for them
+template <class T>
+concept is_streamable = requires(std::ostream &out, const T &x) { out << x; };
+
+// Distinguish class types, regardless from std or user-defined
+template <class T>
+concept is_class = std::is_class_v<T>;
+
+// Distinguish the classes with the PrettyPrint() method of DERIVE_DEBUG
+template <class T>
+concept has_derive_debug = requires(T &x, Context &ctx) { x.PrettyPrint(ctx); };
+
+// Distinguish the ranges of key-value pairs, e.g. std::map or
+// std::unordered_map
+template <class T>
+concept is_map = is_class<T> && std::ranges::input_range<T> &&
+                 !has_derive_debug<T> && requires {
+                   typename T::key_type;
+                   typename T::mapped_type;
+                 };
+
+// Distinguish the other ranges, that are printed element by element, e.g.
+// std::vector, std::list, std::set, std::span or a view. The strings and the
+// classes with DERIVE_DEBUG are printed as such
+template <class T>
+concept is_sequence = is_class<T> && std::ranges::input_range<T> &&
+                      !is_map<T> && !has_derive_debug<T> &&
+                      !std::convertible_to<const T &, std::string_view>;
+
+// Distinguish arithmetic types that are formatted without the stream: bool and
+// the narrow chars as the stream does, numbers with std::to_chars
+template <class T>
+concept is_arithmetic =
+    std::is_arithmetic_v<T> && !std::same_as<T, wchar_t> &&
+    !std::same_as<T, char8_t> && !std::same_as<T, char16_t> &&
+    !std::same_as<T, char32_t>;
+
+// Distinguish the narrow chars, that are printed as chars rather than numbers
+template <class T>
+concept is_narrow_char = std::same_as<T, char> ||
+                         std::same_as<T, signed char> ||
+                         std::same_as<T, unsigned char>;
+
+// Distinguish the types of raw bytes, the contiguous ranges of them are dumped
+// as bytes rather than printed as chars
+template <class T>
+concept is_byte = std::same_as<T, std::byte> || std::same_as<T, unsigned char>;
+
+// Distinguish the contiguous ranges of bytes, e.g. std::vector<uint8_t> or
+// std::array<std::byte, N>
+template <class T>
+concept is_byte_range = is_sequence<T> &&
+                        std::ranges::contiguous_range<const T> &&
+                        std::ranges::sized_range<const T> &&
+                        is_byte<std::ranges::range_value_t<const T>>;
+
+
+// Enough to format any arithmetic value
+inline constexpr size_t kMaxArithmeticLength = 64;
+
+// Format arithmetic value into [first, last) as the stream does by default,
+// returns the end of the text. With DBG_ROUND_TRIP_FLOATS defined floating
+// point numbers are formatted in the shortest form that reads back exactly
+template <class T>
+  requires is_arithmetic<T>
+char *FormatArithmetic(char *first, char *last, T x);
+
+// Print contiguous arithmetic values formatted into the chunks on the stack,
+// each chunk is appended to the record at once. The separator of the writer
+// goes before each value but the very first one. Returns false once the record
+// is exhausted
+template <class T>
+  requires is_arithmetic<T>
+bool PrintArithmeticValues(Context &ctx, const T *values, size_t count,
+                           bool first);
+
+// Count of the elements printed from each end of the container of given size
+size_t ShownAtEachEnd(const Context &ctx, size_t size);
+
+// Bytes per line of the hex dump, they are converted all at once
+inline constexpr size_t kHexLineBytes = 16;
+
+// Enough to format any line of the hex dump but the indentation: the offset
+// of up to 16 digits, the hex of the bytes split in two halves and the chars
+// between the bars, as hexdump -C makes it
+inline constexpr size_t kMaxHexLineLength =
+    16 + 2 + (3 * kHexLineBytes + 1) + 1 + (kHexLineBytes + 2) + 1;
+
+// Format 16 bytes into 32 hex digits and 16 chars, the unprintable ones are
+// '.'. Takes SSE2 or NEON where there are, the lookup table otherwise
+void FormatHex(const unsigned char *bytes, char *hex, char *chars);
+
+// Format the line of the hex dump of count <= 16 bytes at the given offset
+// into first, returns the end of the text
+char *FormatHexLine(char *first, const unsigned char *bytes, size_t count,
+                    size_t offset);
+
+
+// The writers turn the structure of the record into the text, PrettyPrint()
+// functions only say what goes where. The writer is chosen at compile time, so
+// there's no dispatch per element. TextWriter makes the indented blocks:
+//   [<file>:<line> (<function>) <date> <time>]
+//   <name>: <type> = <value>
+// JsonWriter makes one JSON line per record, chosen by DBG_JSON_LOG:
+//   {"file":..,"line":..,"func":..,"time":..,"args":[{"name":..,"type":..,
+//   "value":..},..]}
+// where the containers are arrays, the maps are arrays of [key,value] and the
+// DERIVE_DEBUG classes and pairs of classes are objects
+struct TextWriter {
+  // Goes between the values of one line, PrintArithmeticValues() writes it
+  static constexpr std::string_view kElementSeparator = ", ";
+
+  // Whether the T values are printed just as FormatArithmetic() makes them,
+  // so the contiguous ones may be formatted in bulk
+  template <class T>
+  static constexpr bool kPlainArithmetic = true;
+
+  // Whether the class elements are shown with their indices, so dbg_diff()
+  // may leave out the unchanged ones
+  static constexpr bool kIndexedColumns = true;
+
+  // The header of the record and what follows the last argument
+  static void BeginRecord(Context &ctx, const CallSite &site);
+  static void EndRecord(Context &ctx);
+
+  // The argument of dbg() or the field of DERIVE_DEBUG around its value
+  static void BeginField(Context &ctx, std::string_view name,
+                         std::string_view type);
+  static void EndField(Context &ctx);
+
+  // The named fields of DERIVE_DEBUG or of the pair with class objects
+  static void BeginObject(Context &ctx);
+  static void EndObject(Context &ctx);
+
+  // The scalars in one line: {1, 2, 3}. Each element is preceded by
+  // RowElement() with its index, the skipped ones are replaced by RowSkipped()
+  static void BeginRow(Context &ctx);
+  static void RowElement(Context &ctx, size_t index);
+  static void RowSkipped(Context &ctx, size_t count);
+  static void EndRow(Context &ctx);
+
+  // The class objects, each one on its own line after the index
+  static void BeginColumn(Context &ctx, std::string_view type);
+  static void BeginColumnElement(Context &ctx, size_t index);
+  static void EndColumnElement(Context &ctx);
+  static void EndColumn(Context &ctx);
+
+  // The key-value pairs, each one on its own line after the key
+  static void BeginMap(Context &ctx, std::string_view key_type,
+                       std::string_view value_type);
+  static void BeginMapKey(Context &ctx);
+  static void BeginMapValue(Context &ctx);
+  static void EndMapValue(Context &ctx);
+  static void EndMap(Context &ctx);
+
+  // The bytes dumped in lines of 16, see FormatHexLine(): {} block of the
+  // lines of the shown ones and of the count of the skipped ones in between.
+  // HexBytes() appends each block of lines at once, returns false once the
+  // record is exhausted
+  static void BeginBytes(Context &ctx, size_t size);
+  static bool HexBytes(Context &ctx, const unsigned char *bytes, size_t offset,
+                       size_t count);
+  static void BytesSkipped(Context &ctx, size_t count);
+  static void EndBytes(Context &ctx, size_t size);
+
+  // The skipped elements of the column or the map and the empty one
+  static void Skipped(Context &ctx, size_t count);
+  static void Empty(Context &ctx);
+
+  // The scalar behind the smart pointer
+  static void BeginPointee(Context &ctx);
+  static void EndPointee(Context &ctx);
+
+  // The class object behind the smart pointer, the header is <prefix type>
+  // followed by @address of the shared one, unless the address is nullptr
+  static void BeginClassPointee(Context &ctx, std::string_view prefix,
+                                std::string_view type, const void *address);
+  static void EndClassPointee(Context &ctx);
+
+  // In place of the class object already printed in the record behind another
+  // shared pointer: <see @address>, and of the null pointer: nullptr
+  static void SeenPointee(Context &ctx, const void *address);
+  static void Null(Context &ctx);
+
+  // In place of the block nested too deep and of the data past the size limit
+  static void TooDeep(Context &ctx);
+  static void Truncated(Context &ctx, bool own_line);
+
+  // Scalar type like int, float or char. Arithmetic ones are formatted
+  // without the stream, the enums it can't print as their underlying values
+  template <class T>
+  static void Scalar(Context &ctx, T x);
+
+  static void String(Context &ctx, std::string_view x);
+};
+
+struct JsonWriter {
+  static constexpr std::string_view kElementSeparator = ",";
+
+  // Only the numbers are the same in JSON: bool is true or false, chars are
+  // strings and the floats that aren't finite are null
+  template <class T>
+  static constexpr bool kPlainArithmetic =
+      std::is_integral_v<T> && !std::same_as<T, bool> && !is_narrow_char<T>;
+
+  // The elements of the array are told only by their places
+  static constexpr bool kIndexedColumns = false;
+
+  static void BeginRecord(Context &ctx, const CallSite &site);
+  static void EndRecord(Context &ctx);
+
+  // The arguments of dbg() are objects with the name, the type and the value,
+  // the fields of DERIVE_DEBUG are members of its object
+  static void BeginField(Context &ctx, std::string_view name,
+                         std::string_view type);
+  static void EndField(Context &ctx);
+
+  static void BeginObject(Context &ctx);
+  static void EndObject(Context &ctx);
+
+  static void BeginRow(Context &ctx);
+  static void RowElement(Context &ctx, size_t index);
+  static void RowSkipped(Context &ctx, size_t count);
+  static void EndRow(Context &ctx);
+
+  static void BeginColumn(Context &ctx, std::string_view type);
+  static void BeginColumnElement(Context &ctx, size_t index);
+  static void EndColumnElement(Context &ctx);
+  static void EndColumn(Context &ctx);
+
+  static void BeginMap(Context &ctx, std::string_view key_type,
+                       std::string_view value_type);
+  static void BeginMapKey(Context &ctx);
+  static void BeginMapValue(Context &ctx);
+  static void EndMapValue(Context &ctx);
+  static void EndMap(Context &ctx);
+
+  // The bytes are the string of their hex digits, " ... N more ... " stands
+  // for the skipped ones in it
+  static void BeginBytes(Context &ctx, size_t size);
+  static bool HexBytes(Context &ctx, const unsigned char *bytes, size_t offset,
+                       size_t count);
+  static void BytesSkipped(Context &ctx, size_t count);
+  static void EndBytes(Context &ctx, size_t size);
+
+  // The skipped elements are the string "... N more ..."
+  static void Skipped(Context &ctx, size_t count);
+  static void Empty(Context &ctx);
+
+  // The pointee is the value itself
+  static void BeginPointee(Context &ctx);
+  static void EndPointee(Context &ctx);
+  static void BeginClassPointee(Context &ctx, std::string_view prefix,
+                                std::string_view type, const void *address);
+  static void EndClassPointee(Context &ctx);
+
+  // The object already printed is the string "<see @address>", the null
+  // pointer is null
+  static void SeenPointee(Context &ctx, const void *address);
+  static void Null(Context &ctx);
+
+  // The block nested too deep is the string "{...}", the record past the size
+  // limit ends with "truncated":true
+  static void TooDeep(Context &ctx);
+  static void Truncated(Context &ctx, bool own_line);
+
+  template <class T>
+  static void Scalar(Context &ctx, T x);
+
+  // Quoted and escaped
+  static void String(Context &ctx, std::string_view x);
+
+ private:
+  // The comma before the element, unless it's the first one in its block
+  static void Separate(Context &ctx);
+};
+
+#if defined(DBG_JSON_LOG)
+using Writer = JsonWriter;
+#else
+using Writer = TextWriter;
+#endif
+
+
+// Call print(element, index) on the elements of the range that fit into the
+// limits and skip(count) in place of the ones in between, the skipped elements
+// aren't visited. Stops once the record is exhausted. The size of the range
+// that is passed only once is known at its end, so the elements of both ends
+// are shown from its start and the rest is counted
+template <class R, class Print, class Skip>
+void ForEachShown(Context &ctx, const R &x, bool own_line, Print print,
+                  Skip skip);
+
+// Print the range of scalars in one line: {1, 2, 3}
+// Contiguous arithmetic values are formatted in bulk
+template <class R>
+void PrintScalarSequence(Context &ctx, const R &x);
+
+// Print the range of class objects, each one on its own line after the index
+template <class R>
+void PrintClassSequence(Context &ctx, const R &x);
+
+// Print the range of key-value pairs, each one on its own line after the key
+template <class R>
+void PrintMap(Context &ctx, const R &x);
+
+// Dump the bytes in lines of offset, hex and chars. The limit of elements
+// counts the bytes
+void PrintBytes(Context &ctx, const unsigned char *bytes, size_t size);
+
+// The container std::queue, std::stack or std::priority_queue keeps its
+// elements in, so they are read in place instead of popping a copy
+template <class A>
+const typename A::container_type &UnderlyingContainer(const A &x);
+
+// The view that is iterated only while mutable, e.g. std::views::filter
+// caching its begin or std::views::istream, iterated through the const one
+template <class R>
+struct MutableView {
+  R *view;
+
+  auto begin() const {
+    return std::ranges::begin(*view);
+  }
+
+  auto end() const {
+    return std::ranges::end(*view);
+  }
+
+  auto size() const
+    requires std::ranges::sized_range<R>
+  {
+    return std::ranges::size(*view);
+  }
+};
+
+// The argument of dbg_hex(), dumped as bytes: the elements of the contiguous
+// range or the object representation of anything else trivially copyable. It's
+// named after the type of the argument
+template <class T>
+struct HexDump {
+  const T &x;
+};
+
+template <class T>
+inline constexpr auto static_type_name<HexDump<T>> = static_type_name<T>;
+
+// The argument of dbg_stats(), summarized instead of printed element by
+// element. It's named after the type of the argument
+template <class T>
+struct Stats {
+  const T &x;
+};
+
+template <class T>
+inline constexpr auto static_type_name<Stats<T>> = static_type_name<T>;
+
+// The finite values summarized by dbg_stats() are counted into the buckets of
+// equal width between min and max
+inline constexpr size_t kStatsBuckets = 16;
+
+// The ranges from this size up are summarized in chunks on all cores, if
+// DBG_PARALLEL_STATS is defined
+inline constexpr size_t kParallelStatsSize = size_t{1} << 20;
+inline constexpr size_t kParallelStatsChunks = 64;
+
+// The summary of the range of numbers. Min, max, sum and the histogram are
+// the ones of the finite values, squares are the ones of their deviations
+// from the mean
+template <class E>
+struct NumberStats {
+  uint64_t count = 0;
+  uint64_t nan = 0;
+  uint64_t inf = 0;
+  uint64_t finite = 0;
+  E min = std::numeric_limits<E>::max();
+  E max = std::numeric_limits<E>::lowest();
+  double sum = 0;
+  double squares = 0;
+  std::array<uint64_t, kStatsBuckets> histogram{};
+
+  double Mean() const {
+    return finite == 0 ? 0 : sum / static_cast<double>(finite);
+  }
+
+  // Merge min, max and sum of the other part of the range
+  void AddMoments(const NumberStats &other);
+
+  // Merge squares and the histogram of the other part of the range
+  void AddSpread(const NumberStats &other);
+};
+
+
+// Print scalar type like int, float or char. Arithmetic ones are formatted
+// without the stream
+template <class T>
+  requires is_scalar<T>
+void PrettyPrint(Context &ctx, T x);
+
+// Print any class object, that isn't overloaded later
+// Note that class must generate PrettyPrint method using DERIVE_DEBUG macro
+template <class T>
+  requires is_class<T>
+void PrettyPrint(Context &ctx, const T &x);
+
+
+// Print what's behind std::ref
+template <class T>
+void PrettyPrint(Context &ctx, std::reference_wrapper<T> x);
+
+
+// Print std::pair of two scalars
+template <class F, class S>
+  requires is_scalar<F> && is_scalar<S>
+void PrettyPrint(Context &ctx, const std::pair<F, S> &x);
+
+// Print std::pair where at least one element is class object
+template <class F, class S>
+  requires is_class<F> || is_class<S>
+void PrettyPrint(Context &ctx, const std::pair<F, S> &x);
+
+
+// Print std::string
+void PrettyPrint(Context &ctx, const std::string &x);
+
+// Print std::string_view
+void PrettyPrint(Context &ctx, const std::string_view &x);
+
+// Print std::stringstream contents
+void PrettyPrint(Context &ctx, const std::stringstream &x);
+
+
+// Print any range of scalars in one line and any range of class objects each
+// one on its own line after the index: std::array, std::vector, std::deque,
+// std::list, std::set, std::unordered_set, std::span, the views and so on
+// The contiguous ranges of bytes are dumped in lines of offset, hex and chars
+template <class R>
+  requires is_sequence<R>
+void PrettyPrint(Context &ctx, const R &x);
+
+
+// Print any range of key-value pairs, std::map, std::unordered_map and so on,
+// regardless keys and values are scalars or class objects
+template <class R>
+  requires is_map<R>
+void PrettyPrint(Context &ctx, const R &x);
+
+
+// Print the argument of dbg_hex() as the dump of its bytes
+template <class T>
+void PrettyPrint(Context &ctx, const HexDump<T> &x);
+
+// Print the argument of dbg_stats() as the summary of its numbers
+template <class T>
+void PrettyPrint(Context &ctx, const Stats<T> &x);
+
+
+// Print std::queue of scalars from front to back
+template <class T, class C>
+  requires is_scalar<T>
+void PrettyPrint(Context &ctx, const std::queue<T, C> &x);
+
+// Print std::queue of class objects from front to back
+template <class T, class C>
+  requires is_class<T>
+void PrettyPrint(Context &ctx, const std::queue<T, C> &x);
+
+
+// Print std::stack of scalars from top to bottom
+template <class T, class C>
+  requires is_scalar<T>
+void PrettyPrint(Context &ctx, const std::stack<T, C> &x);
+
+// Print std::stack of class objects from top to bottom
+template <class T, class C>
+  requires is_class<T>
+void PrettyPrint(Context &ctx, const std::stack<T, C> &x);
+
+
+// Print std::priority_queue of scalars in the heap order, top first
+template <class T, class C, class Compare>
+  requires is_scalar<T>
+void PrettyPrint(Context &ctx, const std::priority_queue<T, C, Compare> &x);
+
+// Print std::priority_queue of class objects in the heap order, top first
+template <class T, class C, class Compare>
+  requires is_class<T>
+void PrettyPrint(Context &ctx, const std::priority_queue<T, C, Compare> &x);
+
+
+// Print unique pointer to scalar, the null ones as nullptr as all the smart
+// pointers
+template <class T>
+  requires is_scalar<T>
+void PrettyPrint(Context &ctx, const std::unique_ptr<T> &x);
+
+// Print unique pointer to class
+template <class T>
+  requires is_class<T>
+void PrettyPrint(Context &ctx, const std::unique_ptr<T> &x);
+
+
+// Print shared pointer to scalar
+template <class T>
+  requires is_scalar<T>
+void PrettyPrint(Context &ctx, const std::shared_ptr<T> &x);
+
+// Print shared pointer to class, the object once per record and the pointers
+// it's seen behind again as its address
+template <class T>
+  requires is_class<T>
+void PrettyPrint(Context &ctx, const std::shared_ptr<T> &x);
+
+
+// Take the next argument name that dbg or DERIVE_DEBUG was called with from
+// the stringized argument list, starting at idx. Returns the name and the
+// index the following one starts at, or the empty name if there are no more.
+// DERIVE_DEBUG can be called with fields, expressions and method calls, for
+// instance: DERIVE_DEBUG(a, b + c, (Method(a, b))). In order to correctly split
+// on ["a", "b + c", "Method(a, b)"], not ["a", "b + c", "Method(a", "b)"],
+// the method callings should be enclosed in parentheses.
+constexpr std::pair<std::string_view, size_t> NextArgName(std::string_view args,
+                                                          size_t idx) {
+  auto is_space = [](char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' ||
+           c == '\r';
+  };
+  for (; idx < args.size() and is_space(args[idx]); ++idx) {
+  }
+  if (idx >= args.size()) {
+    return {"", args.size()};
+  }
+
+  if (args[idx] == '(') {
+    size_t end = idx + 1;
+    for (int lvl = 1; end < args.size(); ++end) {
+      if (args[end] == '(') {
+        ++lvl;
+      } else if (args[end] == ')') {
+        --lvl;
+      }
+
+      if (lvl == 0) {
+        break;
+      }
+    }
+    std::string_view name = args.substr(idx + 1, end - idx - 1);
+    for (; end < args.size() and args[end] != ','; ++end) {
+    }
+    return {name, end + 1};
+  }
+
+  size_t end = idx + 1;
+  for (; end < args.size() and args[end] != ','; ++end) {
+  }
+  return {args.substr(idx, end - idx), end + 1};
+}
+
+// Count the argument names in the stringized argument list
+consteval size_t CountArgNames(std::string_view args) {
+  size_t count = 0;
+  for (size_t idx = 0; idx < args.size(); ++count) {
+    idx = NextArgName(args, idx).second;
+  }
+  // The list may end with spaces only, that isn't a name
+  return NextArgName(args, 0).first.empty() ? 0 : count;
+}
+
+// Split the stringized argument list into N names at compile time, dbg() and
+// DERIVE_DEBUG keep the result in a static constant, so printing the record
+// only indexes into it
+template <size_t N>
+consteval std::array<std::string_view, N> SplitArgNames(std::string_view args) {
+  std::array<std::string_view, N> names;
+  size_t idx = 0;
+  for (std::string_view &name : names) {
+    auto [next_name, next_idx] = NextArgName(args, idx);
+    name = next_name;
+    idx = next_idx;
+  }
+  return names;
+}
+
+
+#if defined(DBG_BINARY_LOG)
+// The binary log keeps the raw values, tools/dbg_decode.cc renders them into
+// the text log offline. It's the header followed by the entries, each call
+// site is described by its own entry once, before its first record:
+//   header: "DBGBIN" version:u8 flags:u8 byte_order:u32
+//   site:   'S' id:u32 line:u32 file:str func:str count:u32
+//           count * (name:str type:str)
+//   record: 'R' id:u32 time:i64 count * value
+// where str is size:u64 followed by the chars. The numbers are in the byte
+// order of the writing machine, byte_order is 0x01020304 written in it. The
+// time is in nanoseconds of system_clock, or of steady_clock with
+// DBG_MONOTONIC_TIME
+inline constexpr std::string_view kBinaryMagic = "DBGBIN";
+inline constexpr uint8_t kBinaryVersion = 1;
+inline constexpr uint32_t kBinaryByteOrder = 0x01020304;
+
+// Flags of the header, the decoder renders the text log as they say
+inline constexpr uint8_t kMonotonicTimeFlag = 1;
+inline constexpr uint8_t kRoundTripFloatsFlag = 2;
+
+// The tags the entries start with
+enum class EntryTag : char {
+  kSite = 'S',
+  kRecord = 'R',
+};
+
+// The tags the values start with
+enum class ValueTag : char {
+  // ScalarCode:u8 and the raw value
+  kScalar = 'V',
+  // ScalarCode:u8 size:u64 shown_at_each_end:u64 and the raw values shown
+  kArray = 'A',
+  // The chars of std::string or std::string_view as str
+  kString = 'Z',
+  // Anything else printed into str just as the text log has it
+  kText = 'T',
+};
+
+// Type of the raw value. Chars and bool take a byte, long double is written
+// as double
+enum class ScalarCode : uint8_t {
+  kBool,
+  kChar,
+  kInt8,
+  kInt16,
+  kInt32,
+  kInt64,
+  kUInt8,
+  kUInt16,
+  kUInt32,
+  kUInt64,
+  kFloat,
+  kDouble,
+};
+
+// Distinguish the contiguous ranges of arithmetic values, e.g. std::array,
+// std::vector or std::span, that are written raw. The ones of bytes go as the
+// text of their dump
+template <class T>
+concept is_raw_array = is_sequence<T> && !is_byte_range<T> &&
+                       std::ranges::contiguous_range<const T> &&
+                       std::ranges::sized_range<const T> &&
+                       is_arithmetic<std::ranges::range_value_t<const T>>;
+
+// Flags of the header this file is configured for
+constexpr uint8_t BinaryFlags();
+
+// Header of the binary log, written before the first entry
+std::string_view BinaryHeader();
+
+// Time of the record in nanoseconds
+int64_t BinaryTime();
+
+// Append the bytes of the value as it's kept in the memory
+template <class T>
+void AppendRaw(RecordBuffer &buffer, const T &x);
+
+// Append str: the size and the chars
+void AppendString(RecordBuffer &buffer, std::string_view text);
+
+// Code of the type the arithmetic value is written raw as
+template <class T>
+  requires is_arithmetic<T>
+constexpr ScalarCode ScalarCodeOf();
+
+// Append the arithmetic values converted to the types of their code
+template <class T>
+  requires is_arithmetic<T>
+void AppendScalars(RecordBuffer &buffer, const T *values, size_t count);
+
+// Id of the call site in the binary log. On the first record of the site
+// takes the next id and passes the site entry to the sink
+template <size_t N, class... Args>
+uint32_t BinarySiteId(CallSite &site,
+                      const std::array<std::string_view, N> &names,
+                      const Args &...args);
+
+// Write the value into the binary record, the raw bytes when it's one of the
+// ValueTag kinds and the text printed by PrettyPrint() otherwise. The limit of
+// elements applies to the raw arrays too, the one of bytes to the text only
+template <class T>
+void PrintBinaryValue(Context &ctx, const T &x);
+#endif
+
+
+// Call the PrettyPrint on the last argument from the given variadic list
+// assigning it the current name.
+template <class T>
+void MultiplexPrettyPrintOnNamedArgs(Context &ctx, const std::string_view *name,
+                                     const T &last) {
+  if (ctx.Exhausted(true)) {
+    return;
+  }
+  DiffScope scope(ctx, *name);
+  Writer::BeginField(ctx, *name, TypeName<T>());
+  PrettyPrint(ctx, last);
+  Writer::EndField(ctx);
+}
+
+// Call the PrettyPrint on the first argument from the given variadic list
+// assigning it the current name. The following call reduces argument list and
+// the names by one
+template <class T, class... Args>
+void MultiplexPrettyPrintOnNamedArgs(Context &ctx, const std::string_view *name,
+                                     const T &first, const Args &...args) {
+  if (ctx.Exhausted(true)) {
+    return;
+  }
+  {
+    DiffScope scope(ctx, *name);
+    Writer::BeginField(ctx, *name, TypeName<T>());
+    PrettyPrint(ctx, first);
+    Writer::EndField(ctx);
+  }
+  MultiplexPrettyPrintOnNamedArgs(ctx, name + 1, args...);
+}
+
+// Start calling PrettyPrint on the arguments one by one along with the names
+// that dbg or DERIVE_DEBUG was called with
+template <size_t N, class... Args>
+void MultiplexPrettyPrintOnVaArgs(Context &ctx,
+                                  const std::array<std::string_view, N> &names,
+                                  const Args &...args) {
+  // Unparenthesized expression with commas gives more names than arguments
+  static_assert(N >= sizeof...(Args), "Each argument must have a name");
+  MultiplexPrettyPrintOnNamedArgs(ctx, names.data(), args...);
+}
+
+// Put the arguments of dbg() into the record along with their names. The
+// binary log has them written raw after the id of the call site and the time
+template <size_t N, class... Args>
+void RecordArgs(Context &ctx, CallSite &site,
+                const std::array<std::string_view, N> &names,
+                const Args &...args) {
+#if defined(DBG_BINARY_LOG)
+  static_assert(N >= sizeof...(Args), "Each argument must have a name");
+  uint32_t id = BinarySiteId(site, names, args...);
+  AppendRaw(ctx.buffer, EntryTag::kRecord);
+  AppendRaw(ctx.buffer, id);
+  AppendRaw(ctx.buffer, BinaryTime());
+  const std::string_view *name = names.data();
+  auto print = [&ctx, &name](const auto &x) {
+    DiffScope scope(ctx, *name++);
+    PrintBinaryValue(ctx, x);
+  };
+  (print(args), ...);
+#else
+  static_cast<void>(site);
+  MultiplexPrettyPrintOnVaArgs(ctx, names, args...);
+#endif
+}
+
+// Put the arguments of dbg_hex() into the record as the dumps of their bytes
+template <size_t N, class... Args>
+void RecordHexArgs(Context &ctx, CallSite &site,
+                   const std::array<std::string_view, N> &names,
+                   const Args &...args) {
+  RecordArgs(ctx, site, names, HexDump<Args>{args}...);
+}
+
+// Put the arguments of dbg_stats() into the record as the summaries of their
+// numbers
+template <size_t N, class... Args>
+void RecordStatsArgs(Context &ctx, CallSite &site,
+                     const std::array<std::string_view, N> &names,
+                     const Args &...args) {
+  RecordArgs(ctx, site, names, Stats<Args>{args}...);
+}
+
+// Put the arguments of dbg_diff() into the record and cut out what didn't
+// change since the last record of the site. Returns false and clears the
+// record if nothing did
+template <size_t N, class... Args>
+bool RecordDiffArgs(Context &ctx, DiffSite &site,
+                    const std::array<std::string_view, N> &names,
+                    const Args &...args) {
+  std::lock_guard lock(site.mutex);
+  ctx.diffing = true;
+  ctx.diff_spans.clear();
+  RecordArgs(ctx, site.site, names, args...);
+  ctx.diffing = false;
+  if (!LeaveOutUnchanged(ctx, site)) {
+    ctx.buffer.Clear();
+    return false;
+  }
+  return true;
+}
+
+}  // namespace __dbg_internal
+
+
+// Names of the arguments dbg or DERIVE_DEBUG was called with, split at compile
+// time. Initializes the static constant, so nothing is left for the runtime
+#define DBG_ARG_NAMES(...)                                                    \
+  __dbg_internal::SplitArgNames<__dbg_internal::CountArgNames(#__VA_ARGS__)>( \
+      #__VA_ARGS__)
+
+// Make the record of dbg() within the given limits if the condition holds,
+// the arguments are put into it by record, e.g. __dbg_internal::RecordArgs.
+// The condition may refer to the static descriptor of the call site __dbg_site
+#define DBG_RECORD_WITH(record, cond, limits, ...)                           \
+  if (static __dbg_internal::CallSite __dbg_site{__FILE__, __LINE__,         \
+                                                 __func__};                  \
+      __dbg_internal::dbg_enabled && __dbg_site.Selected() && (cond)) {      \
+    static thread_local __dbg_internal::LeaseSlot __dbg_usage;               \
+    __dbg_internal::Context &__dbg_ctx =                                     \
+        __dbg_internal::BeginRecord(__dbg_site, limits);                     \
+    static constexpr auto __dbg_names = DBG_ARG_NAMES(__VA_ARGS__);          \
+    record(__dbg_ctx, __dbg_site, __dbg_names, __VA_ARGS__);                 \
+    __dbg_internal::CommitRecord(__dbg_ctx, __dbg_site, __dbg_usage);        \
+  }
+
+// Make the record of dbg() within the given limits if the condition holds.
+// The condition may refer to the static descriptor of the call site __dbg_site
+#define DBG_RECORD(cond, limits, ...)                                        \
+  DBG_RECORD_WITH(__dbg_internal::RecordArgs, cond, limits, __VA_ARGS__)
+
+// Print the debug information in the following form:
+// [<file>:<line> (<function>) <date> <time>]
+// <variable>: <type> = <pretty-printed variable>
+// This is repeated for each nested variable with the nice indentation
+#define dbg(...) DBG_RECORD(true, __dbg_internal::Limits{}, __VA_ARGS__)
+
+// Sampled dbg(...): makes the record on the first hit of the call site and on
+// each n-th after
+#define dbg_every_n(n, ...)                                                  \
+  DBG_RECORD(__dbg_site.EveryNth(n), __dbg_internal::Limits{}, __VA_ARGS__)
+
+// Sampled dbg(...): makes the records on the first n hits of the call site
+#define dbg_first_n(n, ...)                                                  \
+  DBG_RECORD(__dbg_site.FirstN(n), __dbg_internal::Limits{}, __VA_ARGS__)
+
+// Rate-limited dbg(...): makes at most k records per second at the call site
+#define dbg_per_second(k, ...)                                               \
+  DBG_RECORD(__dbg_site.PerSecond(k), __dbg_internal::Limits{}, __VA_ARGS__)
+
+// dbg(...) within its own limits, see __dbg_internal::Limits. The ones given
+// as 0 are taken from the limits of all records
+#define dbg_limit(elements, depth, bytes, ...)                               \
+  DBG_RECORD(true, (__dbg_internal::Limits{elements, depth, bytes}),         \
+             __VA_ARGS__)
+
+// dbg(...) with the bytes of each argument dumped in lines of offset, hex and
+// chars: the elements of the contiguous range or the object representation of
+// anything else trivially copyable
+#define dbg_hex(...)                                                         \
+  DBG_RECORD_WITH(__dbg_internal::RecordHexArgs, true,                       \
+                  __dbg_internal::Limits{}, __VA_ARGS__)
+
+// dbg(...) with each range of numbers summarized instead of printed: the
+// count, min, max, mean, stddev, the counts of NaN and infinities and the
+// histogram of the values between min and max
+#define dbg_stats(...)                                                       \
+  DBG_RECORD_WITH(__dbg_internal::RecordStatsArgs, true,                     \
+                  __dbg_internal::Limits{}, __VA_ARGS__)
+
+// dbg(...) that shows only what changed since the last record of the call
+// site: the arguments, the fields, the class elements and the map entries
+// whose text differs, within the blocks of the changed ones. Nothing is
+// recorded if none of the arguments changed
+#define dbg_diff(...)                                                        \
+  if (static __dbg_internal::DiffSite __dbg_diff_site{                       \
+          {__FILE__, __LINE__, __func__}};                                   \
+      __dbg_internal::dbg_enabled && __dbg_diff_site.site.Selected()) {      \
+    static thread_local __dbg_internal::LeaseSlot __dbg_usage;               \
+    __dbg_internal::Context &__dbg_ctx = __dbg_internal::BeginRecord(        \
+        __dbg_diff_site.site, __dbg_internal::Limits{});                     \
+    static constexpr auto __dbg_names = DBG_ARG_NAMES(__VA_ARGS__);          \
+    if (__dbg_internal::RecordDiffArgs(__dbg_ctx, __dbg_diff_site,           \
+                                       __dbg_names, __VA_ARGS__)) {          \
+      __dbg_internal::CommitRecord(__dbg_ctx, __dbg_diff_site.site,          \
+                                   __dbg_usage);                             \
+    } else {                                                                 \
+      __dbg_internal::DropRecord(__dbg_ctx);                                 \
+    }                                                                        \
+  }
+
+
+// Name of the variable unique to the line the macro is expanded at
+#define DBG_CONCAT(a, b) a##b
+#define DBG_LINE_NAME(name, line) DBG_CONCAT(name, line)
+
+// Time the enclosing scope into the histogram of the call site, nothing is
+// printed per hit. The counts and the quantiles are reported on exit and by
+// dbg_dump(). May be given a label, a string literal: dbg_time("parse")
+#define dbg_time(...)                                                        \
+  static __dbg_internal::TimedSite DBG_LINE_NAME(__dbg_timed_site,           \
+                                                 __LINE__){                  \
+      {__FILE__, __LINE__, __func__}, "" __VA_ARGS__};                       \
+  static thread_local __dbg_internal::LeaseSlot DBG_LINE_NAME(               \
+      __dbg_histogram, __LINE__);                                            \
+  __dbg_internal::ScopeTimer DBG_LINE_NAME(__dbg_timer, __LINE__)(           \
+      DBG_LINE_NAME(__dbg_timed_site, __LINE__)                              \
+          .ThreadHistogram(DBG_LINE_NAME(__dbg_histogram, __LINE__)),        \
+      DBG_LINE_NAME(__dbg_timed_site, __LINE__).site)
+
+// Count the hits of the call site, or of each value of the scalar argument:
+// dbg_count() or dbg_count(state). Nothing is printed per hit, the counts are
+// reported on exit and by dbg_dump(), merged across the threads
+#define dbg_count(...)                                                       \
+  if (static __dbg_internal::CountedSite<decltype(                           \
+          __dbg_internal::CountKeyOf(__VA_ARGS__))>                          \
+          __dbg_counted_site{__FILE__, __LINE__, __func__, #__VA_ARGS__};    \
+      __dbg_internal::dbg_enabled && __dbg_counted_site.Selected()) {        \
+    static thread_local __dbg_internal::LeaseSlot __dbg_shard;               \
+    __dbg_counted_site.ThreadShard(__dbg_shard).Add(__VA_ARGS__);            \
+  }
+
+
+// Generate the PrettyPrint() method within class, that will called from
+// __dbg_internal::PrettyPrint function for user-defined classes.
+// DERIVE_DEBUG can be called with fields, expressions and method calls, for
+// instance: DERIVE_DEBUG(a, b + c, (Method(a, b))). In order to correctly split
+// on ["a", "b + c", "Method(a, b)"], not ["a", "b + c", "Method(a", "b)"],
+// the method callings should be enclosed in parentheses.
+#define DERIVE_DEBUG(...)                                                    \
+  void PrettyPrint(__dbg_internal::Context &__dbg_ctx) {                     \
+    __dbg_internal::Writer::BeginObject(__dbg_ctx);                          \
+    static constexpr auto __dbg_names = DBG_ARG_NAMES(__VA_ARGS__);          \
+    __dbg_internal::MultiplexPrettyPrintOnVaArgs(__dbg_ctx, __dbg_names,     \
+                                                 __VA_ARGS__);               \
+    __dbg_internal::Writer::EndObject(__dbg_ctx);                            \
+  }
+
+
+// This provides the ability of turning off debugging on some areas of code
+#define DISABLE_DEBUG __dbg_internal::dbg_enabled = false;
+#define ENABLE_DEBUG __dbg_internal::dbg_enabled = true;
+
+// This provides the ability of reading DBG_FILTER again, e.g. after setenv()
+// or on the signal the program handles itself. Each call site is decided on
+// once more on its next hit
+#define RELOAD_DEBUG_FILTER __dbg_internal::ReloadFilter();
+
+
+// This provides the ability of changing the flush policy at runtime, see
+// __dbg_internal::FlushPolicy for what each of them risks
+#define FLUSH_DEBUG_EVERY_RECORD                                             \
+  __dbg_internal::SetFlushPolicy(__dbg_internal::FlushPolicy::kEveryRecord, 0);
+#define FLUSH_DEBUG_EVERY_BYTES(n)                                           \
+  __dbg_internal::SetFlushPolicy(__dbg_internal::FlushPolicy::kEveryBytes, n);
+#define FLUSH_DEBUG_EVERY_MS(t)                                              \
+  __dbg_internal::SetFlushPolicy(__dbg_internal::FlushPolicy::kEveryMillis, t);
+#define FLUSH_DEBUG_ON_EXIT                                                  \
+  __dbg_internal::SetFlushPolicy(__dbg_internal::FlushPolicy::kOnExit, 0);
+
+
+// This provides the ability of changing the limits of all records at runtime,
+// see __dbg_internal::Limits
+#define LIMIT_DEBUG(elements, depth, bytes)                                  \
+  __dbg_internal::SetLimits({elements, depth, bytes});
+
+
+// Write out what's kept in the memory: the records of DBG_FLIGHT_RECORDER, or
+// whatever the sink holds otherwise
+#define dbg_dump() __dbg_internal::Dump()
+
+
+// implementation
+namespace __dbg_internal {
+
+#if defined(DBG_DEFINE_CORE)
+// Change the flush policy, amount is in bytes or milliseconds
+DBG_INLINE void SetFlushPolicy(FlushPolicy policy, size_t amount) {
+  flush_amount.store(amount, std::memory_order_relaxed);
+  flush_policy.store(policy, std::memory_order_relaxed);
+}
+
+// Tell if the policy says it's time to flush the output, given the bytes
+// written into it since the last flush made at the given time
+DBG_INLINE bool FlushDue(size_t unflushed,
+                         std::chrono::steady_clock::time_point last) {
+  if (unflushed == 0) {
+    return false;
+  }
+  switch (flush_policy.load(std::memory_order_relaxed)) {
+    case FlushPolicy::kEveryRecord:
+      return true;
+    case FlushPolicy::kEveryBytes:
+      return unflushed >= flush_amount.load(std::memory_order_relaxed);
+    case FlushPolicy::kEveryMillis:
+      return std::chrono::steady_clock::now() - last >=
+             std::chrono::milliseconds(
+                 flush_amount.load(std::memory_order_relaxed));
+    case FlushPolicy::kOnExit:
+      break;
+  }
+  return false;
+}
+
+#if defined(DBG_WRITE_TO_SOCKET)
+// The batch is sent once it's full or the background writer has drained the
+// queue, then it's called with nothing written. The flush policies don't apply
+DBG_INLINE void FlushSinkIfDue(size_t written) {
+  if (written == 0) {
+    sink.ReportDrops(false);
+    sink.Send();
+  }
+}
+
+DBG_INLINE void FlushSink() {
+  sink.ReportDrops(true);
+  sink.Send();
+}
+
+// Each record is the datagram of its own, it needs no separator
+DBG_INLINE void WriteToSink(std::string_view text) {
+  sink.Write(text);
+}
+#elif !defined(DBG_MAPPED_FILE) && !defined(DBG_FLIGHT_RECORDER) &&           \
+    !defined(DBG_SHARDED_LOG)
+// Flush the sink if the policy says it's time, given the size of the record
+// just written. Must be called by the only thread that currently owns the sink
+DBG_INLINE void FlushSinkIfDue(size_t written) {
+  unflushed_bytes += written;
+  if (FlushDue(unflushed_bytes, last_flush)) {
+    FlushSink();
+  }
+}
+
+// Flush the sink now. Must be called by the only thread that currently owns
+// the sink
+DBG_INLINE void FlushSink() {
+  std::flush(sink);
+  unflushed_bytes = 0;
+  last_flush = std::chrono::steady_clock::now();
+}
+
+// Write the finished record into the sink, prepending the separator, and flush
+// it as the policy says. Must be called by the only thread that currently owns
+// the sink
+DBG_INLINE void WriteToSink(std::string_view text) {
+#if defined(DBG_BINARY_LOG)
+  if (!dbg_was_called) {
+    sink << BinaryHeader();
+  }
+#else
+  if (dbg_was_called) {
+    sink << kRecordSeparator;
+  }
+#endif
+  dbg_was_called = true;
+  sink << text;
+  FlushSinkIfDue(text.size());
+#if defined(DBG_ROTATE_BYTES) || defined(DBG_ROTATE_SECONDS)
+  RotateSinkIfDue(text.size());
+#endif
+}
+#endif
+
+
+#if defined(DBG_ROTATE_BYTES) || defined(DBG_ROTATE_SECONDS)
+// Rotate the file if it's time, given the size of the record just written.
+// Must be called by the only thread that currently owns the sink
+DBG_INLINE void RotateSinkIfDue(size_t written) {
+  sink_bytes += written;
+  bool due = false;
+#if defined(DBG_ROTATE_BYTES)
+  due = due || sink_bytes >= static_cast<size_t>(DBG_ROTATE_BYTES);
+#endif
+#if defined(DBG_ROTATE_SECONDS)
+  due = due || std::chrono::steady_clock::now() - sink_opened >=
+                   std::chrono::seconds(DBG_ROTATE_SECONDS);
+#endif
+  if (due) {
+    RotateSink();
+  }
+}
+
+// Rotate the file now and start the new one. Must be called by the only thread
+// that currently owns the sink
+DBG_INLINE void RotateSink() {
+  auto segment = [](int i) { return kLogFile + ("." + std::to_string(i)); };
+  sink.close();
+  if (DBG_ROTATE_KEEP > 0) {
+    std::remove(segment(DBG_ROTATE_KEEP).c_str());
+    for (int i = DBG_ROTATE_KEEP - 1; i > 0; --i) {
+      std::rename(segment(i).c_str(), segment(i + 1).c_str());
+    }
+    std::rename(kLogFile, segment(1).c_str());
+  }
+  sink.open(kLogFile, kLogMode);
+
+  // The new file starts with the record, not with the separator
+  dbg_was_called = false;
+  unflushed_bytes = 0;
+  sink_bytes = 0;
+  sink_opened = std::chrono::steady_clock::now();
+}
+#endif
+
+
+#if defined(DBG_MAPPED_FILE)
+DBG_INLINE MappedFile::MappedFile(const char *name, bool append,
+                                  size_t capacity)
+    : capacity_(capacity) {
+  fd_ = open(name, O_RDWR | O_CREAT | (append ? 0 : O_TRUNC), 0644);
+  struct stat info;
+  if (fd_ < 0 || fstat(fd_, &info) != 0) {
+    return;
+  }
+  start_ = append ? info.st_size : 0;
+  // Sparse file would fail with SIGBUS on the write that finds no disk space
+  if (posix_fallocate(fd_, 0, start_ + capacity_) != 0) {
+    return;
+  }
+  void *data = mmap(nullptr, start_ + capacity_, PROT_READ | PROT_WRITE,
+                    MAP_SHARED, fd_, 0);
+  if (data == MAP_FAILED) {
+    return;
+  }
+  data_ = static_cast<char *>(data);
+#if defined(DBG_BINARY_LOG)
+  Write(BinaryHeader());
+#endif
+}
+
+DBG_INLINE MappedFile::~MappedFile() {
+  if (fd_ < 0) {
+    return;
+  }
+  size_t used = std::min(used_.load(), full_at_.load());
+  if (data_ != nullptr) {
+    munmap(data_, start_ + capacity_);
+  }
+  // The last record has no separator after it
+  used -= std::min(used, kRecordSeparator.size());
+  static_cast<void>(ftruncate(fd_, start_ + used));
+  close(fd_);
+}
+
+// Copy the record into the mapping followed by the separator. May be called
+// from any thread
+DBG_INLINE void MappedFile::Write(std::string_view record) {
+  if (data_ == nullptr) {
+    return;
+  }
+  size_t size = record.size() + kRecordSeparator.size();
+  size_t offset = used_.fetch_add(size, std::memory_order_relaxed);
+  if (offset + size > capacity_) {
+    size_t full_at = full_at_.load(std::memory_order_relaxed);
+    while (offset < full_at &&
+           !full_at_.compare_exchange_weak(full_at, offset,
+                                           std::memory_order_relaxed)) {
+    }
+    return;
+  }
+  char *dest = data_ + start_ + offset;
+  std::copy(record.begin(), record.end(), dest);
+  std::copy(kRecordSeparator.begin(), kRecordSeparator.end(),
+            dest + record.size());
+}
+#endif
+
+
+#if defined(DBG_FLIGHT_RECORDER)
+// Opens the output and installs the handlers
+DBG_INLINE FlightRecorder::FlightRecorder(const char *name, bool append,
+                                          size_t capacity)
+    : capacity_(capacity) {
+  if (name == nullptr) {
+    fd_ = STDOUT_FILENO;
+  } else {
+    fd_ = open(name, O_WRONLY | O_CREAT | (append ? O_APPEND : O_TRUNC), 0644);
+  }
+
+  struct sigaction action = {};
+  action.sa_handler = OnSignal;
+  sigemptyset(&action.sa_mask);
+  for (size_t i = 0; i < kCrashSignals.size(); ++i) {
+    sigaction(kCrashSignals[i], &action, &previous_actions[i]);
+  }
+  previous_terminate_ = std::set_terminate(OnTerminate);
+}
+
+// Copy the record into the ring of the calling thread. May be called from
+// any thread
+DBG_INLINE void FlightRecorder::Write(std::string_view record) {
+  constexpr size_t kFrame = sizeof(uint64_t) + sizeof(uint32_t);
+  Ring &ring = ThreadRing();
+  uint64_t seq = seq_.fetch_add(1, std::memory_order_relaxed);
+  // The record longer than the ring keeps its beginning
+  auto size =
+      static_cast<uint32_t>(std::min(record.size(), capacity_ - kFrame));
+
+  std::lock_guard lock(ring.mutex);
+  uint64_t head = ring.head.load(std::memory_order_relaxed);
+  uint64_t tail = ring.tail.load(std::memory_order_relaxed);
+  while (head + kFrame + size - tail > capacity_) {
+    uint32_t oldest;
+    Read(ring, tail + sizeof(uint64_t), reinterpret_cast<char *>(&oldest),
+         sizeof(oldest));
+    tail += kFrame + oldest;
+  }
+  ring.tail.store(tail, std::memory_order_release);
+  ring.cursor = std::max(ring.cursor, tail);
+
+  auto put = [&](const char *s, size_t n) {
+    for (size_t done = 0; done < n;) {
+      size_t at = (head + done) % capacity_;
+      size_t chunk = std::min(n - done, capacity_ - at);
+      std::copy(s + done, s + done + chunk, ring.data.get() + at);
+      done += chunk;
+    }
+    head += n;
+  };
+  put(reinterpret_cast<const char *>(&seq), sizeof(seq));
+  put(reinterpret_cast<const char *>(&size), sizeof(size));
+  put(record.data(), size);
+  ring.head.store(head, std::memory_order_release);
+}
+
+// Write the records of all rings into the output in the order they were
+// made and forget them. The crash handlers read the rings without the locks
+DBG_INLINE void FlightRecorder::Dump(bool crash) {
+  constexpr size_t kFrame = sizeof(uint64_t) + sizeof(uint32_t);
+  std::unique_lock dump_lock(dump_mutex_, std::defer_lock);
+  Ring *first = rings_.load(std::memory_order_acquire);
+  if (!crash) {
+    dump_lock.lock();
+    for (Ring *ring = first; ring != nullptr; ring = ring->next) {
+      ring->mutex.lock();
+    }
+  }
+
+  // Merge the rings by seq, each one has its records in order
+  for (;;) {
+    Ring *next = nullptr;
+    uint64_t next_seq = 0;
+    for (Ring *ring = first; ring != nullptr; ring = ring->next) {
+      uint64_t tail = ring->tail.load(std::memory_order_acquire);
+      ring->cursor = std::max(ring->cursor, tail);
+      if (ring->cursor >= ring->head.load(std::memory_order_acquire)) {
+        continue;
+      }
+      uint64_t seq;
+      Read(*ring, ring->cursor, reinterpret_cast<char *>(&seq), sizeof(seq));
+      if (next == nullptr || seq < next_seq) {
+        next = ring;
+        next_seq = seq;
+      }
+    }
+    if (next == nullptr) {
+      break;
+    }
+
+    uint32_t size;
+    Read(*next, next->cursor + sizeof(uint64_t),
+         reinterpret_cast<char *>(&size), sizeof(size));
+    if (dumped_any_) {
+      static_cast<void>(
+          write(fd_, kRecordSeparator.data(), kRecordSeparator.size()));
+    }
+    dumped_any_ = true;
+    Output(*next, next->cursor + kFrame, size);
+    next->cursor += kFrame + size;
+  }
+
+  if (!crash) {
+    for (Ring *ring = first; ring != nullptr; ring = ring->next) {
+      ring->mutex.unlock();
+    }
+  }
+}
+
+// The ring the calling thread writes into, it's taken on the first record
+DBG_INLINE Ring &FlightRecorder::ThreadRing() {
+  // Gives the ring back when the thread exits
+  struct Lease {
+    Ring *ring = nullptr;
+
+    ~Lease() {
+      if (ring != nullptr) {
+        ring->owned.store(false, std::memory_order_release);
+      }
+    }
+  };
+  thread_local Lease lease;
+  if (lease.ring != nullptr) {
+    return *lease.ring;
+  }
+
+  for (Ring *ring = rings_.load(std::memory_order_acquire); ring != nullptr;
+       ring = ring->next) {
+    bool owned = false;
+    if (ring->owned.compare_exchange_strong(owned, true,
+                                            std::memory_order_acquire)) {
+      lease.ring = ring;
+      return *ring;
+    }
+  }
+  auto *ring = new Ring;
+  ring->data = std::make_unique<char[]>(capacity_);
+  ring->owned.store(true, std::memory_order_relaxed);
+  ring->next = rings_.load(std::memory_order_relaxed);
+  while (!rings_.compare_exchange_weak(ring->next, ring,
+                                       std::memory_order_release,
+                                       std::memory_order_relaxed)) {
+  }
+  lease.ring = ring;
+  return *ring;
+}
+
+// Copy n bytes of the ring starting at the given position
+DBG_INLINE void FlightRecorder::Read(const Ring &ring, uint64_t pos,
+                                     char *dest, size_t n) const {
+  for (size_t done = 0; done < n;) {
+    size_t at = (pos + done) % capacity_;
+    size_t chunk = std::min(n - done, capacity_ - at);
+    std::copy(ring.data.get() + at, ring.data.get() + at + chunk, dest + done);
+    done += chunk;
+  }
+}
+
+// Write n bytes of the ring starting at the given position to the output
+DBG_INLINE void FlightRecorder::Output(const Ring &ring, uint64_t pos,
+                                       size_t n) {
+  for (size_t done = 0; done < n;) {
+    size_t at = (pos + done) % capacity_;
+    size_t chunk = std::min(n - done, capacity_ - at);
+    ssize_t written = write(fd_, ring.data.get() + at, chunk);
+    if (written < 0 && errno == EINTR) {
+      continue;
+    }
+    if (written <= 0) {
+      return;
+    }
+    done += written;
+  }
+}
+
+DBG_INLINE void FlightRecorder::OnSignal(int signal) {
+  if (!sink.crashed_.exchange(true)) {
+    sink.Dump(true);
+  }
+  // Let the previous handler or the default action finish the process
+  for (size_t i = 0; i < kCrashSignals.size(); ++i) {
+    if (kCrashSignals[i] == signal) {
+      sigaction(signal, &previous_actions[i], nullptr);
+    }
+  }
+  raise(signal);
+}
+
+DBG_INLINE void FlightRecorder::OnTerminate() {
+  if (!sink.crashed_.exchange(true)) {
+    sink.Dump(true);
+  }
+  if (sink.previous_terminate_ != nullptr) {
+    sink.previous_terminate_();
+  }
+  std::abort();
+}
+#endif
+
+
+#if defined(DBG_SHARDED_LOG)
+DBG_INLINE ShardedFile::ShardedFile(const char *name, bool append)
+    : name_(name), append_(append) {
+  // The files are numbered from 0 up, the run with fewer threads would leave
+  // the rest of the old ones to be merged in
+  if (!append) {
+    for (uint32_t n = 0; std::remove(ShardName(n).c_str()) == 0; ++n) {
+    }
+  }
+}
+
+DBG_INLINE ShardedFile::~ShardedFile() {
+  for (Shard *shard = shards_.load(std::memory_order_acquire);
+       shard != nullptr; shard = shard->next) {
+    shard->file.close();
+  }
+}
+
+DBG_INLINE void ShardedFile::Write(std::string_view record) {
+  Shard &shard = ThreadShard();
+  auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch());
+
+  // One number takes at most 20 digits and is followed by the space or \n
+  std::array<char, kShardFrame.size() + 3 * 21> frame;
+  char *end = std::copy(kShardFrame.begin(), kShardFrame.end(), frame.data());
+  for (uint64_t x : {static_cast<uint64_t>(ns.count()), shard.seq++,
+                     static_cast<uint64_t>(record.size())}) {
+    end = std::to_chars(end, end + 20, x).ptr;
+    *end++ = ' ';
+  }
+  end[-1] = '\n';
+  shard.file.write(frame.data(), end - frame.data());
+  shard.file.write(record.data(), record.size());
+
+  shard.unflushed_bytes += (end - frame.data()) + record.size();
+  if (FlushDue(shard.unflushed_bytes, shard.last_flush)) {
+    Flush(shard);
+  }
+}
+
+DBG_INLINE void ShardedFile::Flush() {
+  if (thread_shard_ != nullptr) {
+    Flush(*thread_shard_);
+  }
+}
+
+DBG_INLINE void ShardedFile::Flush(Shard &shard) {
+  shard.file.flush();
+  shard.unflushed_bytes = 0;
+  shard.last_flush = std::chrono::steady_clock::now();
+}
+
+// The shard the calling thread writes into, it's taken on the first record
+DBG_INLINE Shard &ShardedFile::ThreadShard() {
+  if (thread_shard_ != nullptr) {
+    return *thread_shard_;
+  }
+
+  // Gives the shard back when the thread exits. The records made after that,
+  // by the destructors of the statics, take a shard again and keep it
+  struct Lease {
+    ~Lease() {
+      if (thread_shard_ != nullptr) {
+        thread_shard_->owned.store(false, std::memory_order_release);
+        thread_shard_ = nullptr;
+      }
+    }
+  };
+  thread_local Lease lease;
+
+  for (Shard *shard = shards_.load(std::memory_order_acquire);
+       shard != nullptr; shard = shard->next) {
+    bool owned = false;
+    if (shard->owned.compare_exchange_strong(owned, true,
+                                             std::memory_order_acquire)) {
+      thread_shard_ = shard;
+      return *shard;
+    }
+  }
+  auto *shard = new Shard;
+  shard->file.open(ShardName(count_.fetch_add(1, std::memory_order_relaxed)),
+                   append_ ? std::ios_base::app : std::ios_base::out);
+  shard->last_flush = std::chrono::steady_clock::now();
+  shard->owned.store(true, std::memory_order_relaxed);
+  shard->next = shards_.load(std::memory_order_relaxed);
+  while (!shards_.compare_exchange_weak(shard->next, shard,
+                                        std::memory_order_release,
+                                        std::memory_order_relaxed)) {
+  }
+  thread_shard_ = shard;
+  return *shard;
+}
+
+// The name of the file with the given number
+DBG_INLINE std::string ShardedFile::ShardName(uint32_t n) const {
+  size_t dot = name_.rfind('.');
+  return std::string(name_.substr(0, dot)) + "." + std::to_string(n) +
+         std::string(name_.substr(dot));
+}
+#endif
+
+
+#if defined(DBG_WRITE_TO_SOCKET)
+DBG_INLINE SocketSink::SocketSink(const char *address) {
+  std::string_view spec = address;
+  if (spec.starts_with("unix:")) {
+    std::string_view path = spec.substr(5);
+    sockaddr_un un{};
+    if (path.empty() || path.size() >= sizeof(un.sun_path)) {
+      return;
+    }
+    un.sun_family = AF_UNIX;
+    std::copy(path.begin(), path.end(), un.sun_path);
+    std::memcpy(&address_, &un, sizeof(un));
+    address_size_ = sizeof(un);
+    fd_ = socket(AF_UNIX, SOCK_DGRAM, 0);
+  } else if (spec.starts_with("udp:")) {
+    // The host of IPv6 is in brackets, "udp:[::1]:5140"
+    std::string_view host = spec.substr(4);
+    size_t colon = host.rfind(':');
+    if (colon == std::string_view::npos) {
+      return;
+    }
+    std::string port(host.substr(colon + 1));
+    host = host.substr(0, colon);
+    if (host.starts_with('[') && host.ends_with(']')) {
+      host = host.substr(1, host.size() - 2);
+    }
+    addrinfo hints{};
+    hints.ai_socktype = SOCK_DGRAM;
+    hints.ai_flags = AI_NUMERICSERV;
+    addrinfo *found = nullptr;
+    if (getaddrinfo(std::string(host).c_str(), port.c_str(), &hints, &found) !=
+        0) {
+      return;
+    }
+    std::memcpy(&address_, found->ai_addr, found->ai_addrlen);
+    address_size_ = found->ai_addrlen;
+    fd_ = socket(found->ai_family, SOCK_DGRAM, 0);
+    freeaddrinfo(found);
+  }
+  batch_.reserve(kSocketBatchBytes);
+}
+
+DBG_INLINE SocketSink::~SocketSink() {
+  Send();
+  if (fd_ >= 0) {
+    close(fd_);
+  }
+}
+
+// Add the record to the batch, sending the batch first if it's full
+DBG_INLINE void SocketSink::Write(std::string_view record) {
+  if (record.size() > kMaxDatagram) {
+    dropped_records.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  if (count_ == kSocketBatch ||
+      batch_.size() + record.size() > kSocketBatchBytes) {
+    Send();
+  }
+  batch_.append(record);
+  ends_[count_++] = batch_.size();
+}
+
+// Send the records of the batch. What the socket doesn't take right away is
+// dropped, be it the full buffer or the collector that isn't there
+DBG_INLINE void SocketSink::Send() {
+  if (count_ == 0) {
+    return;
+  }
+  std::array<iovec, kSocketBatch> parts;
+  std::array<mmsghdr, kSocketBatch> messages{};
+  for (size_t i = 0, begin = 0; i < count_; begin = ends_[i++]) {
+    parts[i] = {batch_.data() + begin, ends_[i] - begin};
+    messages[i].msg_hdr.msg_name = &address_;
+    messages[i].msg_hdr.msg_namelen = address_size_;
+    messages[i].msg_hdr.msg_iov = &parts[i];
+    messages[i].msg_hdr.msg_iovlen = 1;
+  }
+  size_t sent = 0;
+  while (fd_ >= 0 && sent < count_) {
+    int n = sendmmsg(fd_, messages.data() + sent, count_ - sent, MSG_DONTWAIT);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      break;
+    }
+    sent += n;
+  }
+  if (sent < count_) {
+    dropped_records.fetch_add(count_ - sent, std::memory_order_relaxed);
+  }
+  batch_.clear();
+  count_ = 0;
+}
+
+// Add the record of the records dropped since the start to the batch, if there
+// are new ones since the last such record
+DBG_INLINE void SocketSink::ReportDrops(bool forced) {
+  static CallSite site{__FILE__, __LINE__, "dbg"};
+  uint64_t dropped = dropped_records.load(std::memory_order_relaxed);
+  auto now = std::chrono::steady_clock::now();
+  if (dropped == reported_drops_ ||
+      (!forced && now - last_report_ < std::chrono::seconds(1))) {
+    return;
+  }
+  reported_drops_ = dropped;
+  last_report_ = now;
+
+  Context ctx;
+  std::array<std::string_view, 1> names = {"dropped_records"};
+  BeginRecord(ctx, site, {});
+  RecordArgs(ctx, site, names, dropped);
+  Writer::EndRecord(ctx);
+  Write(ctx.buffer.View());
+}
+#endif
+
+
+#if defined(DBG_ASYNC)
+DBG_INLINE void MpscQueue::Push(RecordNode *node) {
+  node->next.store(nullptr, std::memory_order_relaxed);
+  RecordNode *prev = head_.exchange(node, std::memory_order_acq_rel);
+  prev->next.store(node, std::memory_order_release);
+}
+
+// Returns nullptr if the queue is empty or the only pushed node isn't
+// linked yet
+DBG_INLINE RecordNode *MpscQueue::Pop() {
+  RecordNode *tail = tail_;
+  RecordNode *next = tail->next.load(std::memory_order_acquire);
+  if (tail == &stub_) {
+    if (next == nullptr) {
+      return nullptr;
+    }
+    tail_ = next;
+    tail = next;
+    next = next->next.load(std::memory_order_acquire);
+  }
+  if (next != nullptr) {
+    tail_ = next;
+    return tail;
+  }
+  if (tail != head_.load(std::memory_order_acquire)) {
+    return nullptr;
+  }
+  Push(&stub_);
+  next = tail->next.load(std::memory_order_acquire);
+  if (next != nullptr) {
+    tail_ = next;
+    return tail;
+  }
+  return nullptr;
+}
+
+
+DBG_INLINE AsyncWriter::AsyncWriter() : thread_([this] { Run(); }) {
+}
+
+// Writes the remaining records and joins the thread
+DBG_INLINE AsyncWriter::~AsyncWriter() {
+  {
+    std::lock_guard lock(mutex_);
+    stop_.store(true);
+  }
+  wake_.notify_one();
+  thread_.join();
+  // The thread is gone, so the sink is owned here, along with the records
+  // pushed after it stopped
+  while (RecordNode *node = queue_.Pop()) {
+    Write(node);
+  }
+  FlushSink();
+}
+
+DBG_INLINE void AsyncWriter::Push(RecordNode *node) {
+  queue_.Push(node);
+  if (idle_.load()) {
+    {
+      std::lock_guard lock(mutex_);
+      idle_.store(false);
+    }
+    wake_.notify_one();
+  }
+}
+
+DBG_INLINE void AsyncWriter::Run() {
+  for (;;) {
+    while (RecordNode *node = queue_.Pop()) {
+      Write(node);
+    }
+    // Let the time policy flush the last records without waiting for more
+    FlushSinkIfDue(0);
+
+    std::unique_lock lock(mutex_);
+    if (stop_.load()) {
+      // The records pushed since the drain above are the last ones
+      while (RecordNode *node = queue_.Pop()) {
+        Write(node);
+      }
+      return;
+    }
+    // The timeout covers the push that happened right before going idle
+    idle_.store(true);
+    wake_.wait_for(lock, std::chrono::milliseconds(10),
+                   [this] { return !idle_.load() || stop_.load(); });
+    idle_.store(false);
+  }
+}
+
+// Write the popped node into the sink and give it back to its pool.
+// Must be called by the owner of the sink only
+DBG_INLINE void AsyncWriter::Write(RecordNode *node) {
+  // The node without the text is pushed by Dump()
+  if (node->text.empty()) {
+    FlushSink();
+  } else {
+    WriteToSink(node->text);
+  }
+#if defined(DBG_WRITE_TO_SOCKET)
+  queued_bytes_.fetch_sub(node->text.size(), std::memory_order_relaxed);
+#endif
+  Recycle(node);
+}
+
+// Makes the nodes of the thread
+DBG_INLINE NodePool::NodePool() {
+  for (size_t i = 0; i < DBG_ASYNC_NODES; ++i) {
+    auto *node = new RecordNode;
+    node->text.reserve(DBG_ASYNC_NODE_BYTES);
+    node->pool = this;
+    node->next.store(taken, std::memory_order_relaxed);
+    taken = node;
+  }
+}
+
+// Take the node for the next record from the pool of the calling thread,
+// waiting for the writer if all of them are queued. Its text is empty but
+// keeps the capacity
+DBG_INLINE RecordNode *AsyncWriter::Node() {
+  thread_local LeaseSlot slot;
+  NodePool &pool = slot.item != nullptr ? *static_cast<NodePool *>(slot.item)
+                                        : pools_.Take(slot);
+  while (pool.taken == nullptr) {
+    pool.taken = pool.free.exchange(nullptr, std::memory_order_acquire);
+    if (pool.taken == nullptr) {
+      // The writer is woken by the pushes of the queued nodes
+      std::this_thread::yield();
+    }
+  }
+  RecordNode *node = pool.taken;
+  pool.taken = node->next.load(std::memory_order_relaxed);
+  return node;
+}
+
+#if defined(DBG_WRITE_TO_SOCKET)
+// Count the bytes of the record about to be pushed, unless they would take the
+// queue past DBG_SOCKET_QUEUE_BYTES
+DBG_INLINE bool AsyncWriter::Admit(size_t bytes) {
+  size_t queued = queued_bytes_.fetch_add(bytes, std::memory_order_relaxed);
+  if (queued + bytes > static_cast<size_t>(DBG_SOCKET_QUEUE_BYTES)) {
+    queued_bytes_.fetch_sub(bytes, std::memory_order_relaxed);
+    return false;
+  }
+  return true;
+}
+#endif
+
+// Give the written node back to the pool of its thread. The text of the huge
+// record isn't kept for the small ones
+DBG_INLINE void AsyncWriter::Recycle(RecordNode *node) {
+  if (node->text.capacity() > kMaxRecycledText) {
+    node->text = std::string();
+    node->text.reserve(DBG_ASYNC_NODE_BYTES);
+  } else {
+    node->text.clear();
+  }
+  std::atomic<RecordNode *> &free = node->pool->free;
+  RecordNode *head = free.load(std::memory_order_relaxed);
+  do {
+    node->next.store(head, std::memory_order_relaxed);
+  } while (!free.compare_exchange_weak(head, node, std::memory_order_release,
+                                       std::memory_order_relaxed));
+}
+#endif
+#endif  // DBG_DEFINE_CORE
+
+
+inline std::ostream &operator<<(std::ostream &out, Indentation indent) {
+  for (size_t left = 2 * indent.depth; left > 0;) {
+    size_t chunk = std::min(left, kSpaces.size());
+    out.write(kSpaces.data(), chunk);
+    left -= chunk;
+  }
+  return out;
+}
+
+// Returns false if the address is already in the set
+inline bool AddressSet::Insert(const void *address, const void *type) {
+  // Kept at most half full, so the probes stay short
+  if (2 * (size_ + 1) > slots_.size()) {
+    std::vector<Slot> slots(std::max<size_t>(16, 2 * slots_.size()));
+    std::swap(slots, slots_);
+    uint64_t generation = generation_;
+    size_ = 0;
+    for (const Slot &slot : slots) {
+      if (slot.generation == generation) {
+        Insert(slot.address, slot.type);
+      }
+    }
+  }
+
+  // The low bits of the addresses are the alignment, so they are mixed first
+  size_t mask = slots_.size() - 1;
+  uint64_t hash = reinterpret_cast<uintptr_t>(address) * 0x9e3779b97f4a7c15;
+  for (size_t i = (hash >> 32) & mask;; i = (i + 1) & mask) {
+    Slot &slot = slots_[i];
+    if (slot.generation != generation_) {
+      slot = {address, type, generation_};
+      ++size_;
+      return true;
+    }
+    if (slot.address == address && slot.type == type) {
+      return false;
+    }
+  }
+}
+
+// Tell if the record is too long to show more data. The first time says so
+// in the record, on its own line or right in the current one
+inline bool Context::Exhausted(bool own_line) {
+  if (limits.bytes == 0 || buffer.View().size() < limits.bytes) {
+    return false;
+  }
+  if (!truncated) {
+    truncated = true;
+    Writer::Truncated(*this, own_line);
+  }
+  return true;
+}
+
+
+// Count the hit and tell if it's the first one or the n-th since the last
+// recorded
+inline bool CallSite::EveryNth(uint64_t n) {
+  n = std::max<uint64_t>(n, 1);
+  return hits.fetch_add(1, std::memory_order_relaxed) % n == 0;
+}
+
+// Count the hit and tell if it's one of the first n. Once they are recorded
+// the hits aren't counted, so the check is a single load
+inline bool CallSite::FirstN(uint64_t n) {
+  if (hits.load(std::memory_order_relaxed) >= n) {
+    return false;
+  }
+  return hits.fetch_add(1, std::memory_order_relaxed) < n;
+}
+
+// Tell if less than k records were made within the current second
+inline bool CallSite::PerSecond(uint64_t k) {
+  int64_t now = std::chrono::duration_cast<std::chrono::seconds>(
+                    std::chrono::steady_clock::now().time_since_epoch())
+                    .count();
+  int64_t started = window.load(std::memory_order_relaxed);
+  if (started != now) {
+    // The thread that moves the window resets the count
+    if (window.compare_exchange_strong(started, now,
+                                       std::memory_order_relaxed)) {
+      window_records.store(0, std::memory_order_relaxed);
+    }
+  } else if (window_records.load(std::memory_order_relaxed) >= k) {
+    return false;
+  }
+  return window_records.fetch_add(1, std::memory_order_relaxed) < k;
+}
+
+// Tell if the site is selected by DBG_FILTER. It's decided on the first hit
+// and after each reload, the other hits cost a single load
+inline bool CallSite::Selected() {
+  FilterDecision decision = filter_decision.load(std::memory_order_relaxed);
+  if (decision == FilterDecision::kUndecided) [[unlikely]] {
+    return DecideFilter();
+  }
+  return decision == FilterDecision::kSelected;
+}
+
+// Count the record. Must be called by the owner only
+inline void SiteUsage::Add(uint64_t record_bytes, uint64_t ns) {
+  records.store(records.load(std::memory_order_relaxed) + 1,
+                std::memory_order_relaxed);
+  bytes.store(bytes.load(std::memory_order_relaxed) + record_bytes,
+              std::memory_order_relaxed);
+  format_ns.store(format_ns.load(std::memory_order_relaxed) + ns,
+                  std::memory_order_relaxed);
+}
+
+// The usage of the calling thread kept in the slot, it's taken on its first
+// record
+inline SiteUsage &CallSite::ThreadUsage(LeaseSlot &slot) {
+  if (slot.item != nullptr) [[likely]] {
+    return *static_cast<SiteUsage *>(slot.item);
+  }
+  return TakeUsage(slot);
+}
+
+#if defined(DBG_DEFINE_CORE)
+// Take the usage into the slot and list the site among the accounted
+DBG_INLINE SiteUsage &CallSite::TakeUsage(LeaseSlot &slot) {
+  SiteUsage &usage = usages.Take(slot);
+  if (!accounted.exchange(true, std::memory_order_relaxed)) {
+    next_accounted = accounted_sites.load(std::memory_order_relaxed);
+    while (!accounted_sites.compare_exchange_weak(next_accounted, this,
+                                                  std::memory_order_release,
+                                                  std::memory_order_relaxed)) {
+    }
+  }
+  return usage;
+}
+
+// Decide on the site with the current filter, reading it first if stale
+DBG_INLINE bool CallSite::DecideFilter() {
+  std::lock_guard lock(filter_mutex);
+  // The site is listed before it's decided on, so the reload in between
+  // resets it too
+  if (!decided_once) {
+    decided_once = true;
+    next_decided = decided_sites.load(std::memory_order_relaxed);
+    decided_sites.store(this, std::memory_order_release);
+  }
+  FilterDecision decision;
+  do {
+    if (filter_stale.exchange(false)) {
+      site_filter = SiteFilter::FromEnvironment();
+    }
+    decision = site_filter.Selects(file, func) ? FilterDecision::kSelected
+                                               : FilterDecision::kRejected;
+    filter_decision.store(decision);
+    // Reloaded meanwhile, the decision may be the one of the old filter
+  } while (filter_stale.load());
+  return decision == FilterDecision::kSelected;
+}
+
+// Tell if the glob of * and ? matches the whole text. The * backtracks only to
+// the last one, that's enough for the globs without the other patterns
+DBG_INLINE bool MatchGlob(std::string_view glob, std::string_view text) {
+  size_t g = 0;
+  size_t t = 0;
+  // Where the last * is and where the text it currently matches ends
+  size_t star = std::string_view::npos;
+  size_t star_end = 0;
+  while (t < text.size()) {
+    if (g < glob.size() && (glob[g] == '?' || glob[g] == text[t])) {
+      ++g;
+      ++t;
+    } else if (g < glob.size() && glob[g] == '*') {
+      star = g++;
+      star_end = t;
+    } else if (star != std::string_view::npos) {
+      g = star + 1;
+      t = ++star_end;
+    } else {
+      return false;
+    }
+  }
+  while (g < glob.size() && glob[g] == '*') {
+    ++g;
+  }
+  return g == glob.size();
+}
+
+DBG_INLINE SiteFilter::SiteFilter(std::string_view patterns)
+    : select_all_(false) {
+  constexpr std::string_view kBlanks = " \t\r";
+  while (!patterns.empty()) {
+    size_t end = std::min(patterns.find_first_of(",\n"), patterns.size());
+    std::string_view pattern = patterns.substr(0, end);
+    patterns.remove_prefix(std::min(end + 1, patterns.size()));
+    size_t first = pattern.find_first_not_of(kBlanks);
+    if (first == std::string_view::npos) {
+      continue;
+    }
+    size_t last = pattern.find_last_not_of(kBlanks);
+    pattern = pattern.substr(first, last + 1 - first);
+    size_t colon = pattern.rfind(':');
+    if (colon == std::string_view::npos) {
+      patterns_.push_back({std::string(pattern), "*"});
+    } else {
+      patterns_.push_back({std::string(pattern.substr(0, colon)),
+                           std::string(pattern.substr(colon + 1))});
+    }
+  }
+}
+
+// Read the patterns of DBG_FILTER
+DBG_INLINE SiteFilter SiteFilter::FromEnvironment() {
+  const char *patterns = std::getenv("DBG_FILTER");
+  if (patterns == nullptr) {
+    return SiteFilter();
+  }
+  if (patterns[0] != '@') {
+    return SiteFilter(patterns);
+  }
+  std::ifstream in(patterns + 1);
+  std::stringstream text;
+  if (in) {
+    text << in.rdbuf();
+  }
+  return SiteFilter(text.view());
+}
+
+DBG_INLINE bool SiteFilter::Selects(std::string_view file,
+                                    std::string_view func) const {
+  if (select_all_) {
+    return true;
+  }
+  for (const Pattern &pattern : patterns_) {
+    if (!MatchGlob(pattern.func, func)) {
+      continue;
+    }
+    // The file glob matches the path or its part after any /
+    for (std::string_view path = file;;) {
+      if (MatchGlob(pattern.file, path)) {
+        return true;
+      }
+      size_t slash = path.find('/');
+      if (slash == std::string_view::npos) {
+        break;
+      }
+      path.remove_prefix(slash + 1);
+    }
+  }
+  return false;
+}
+
+// Make the filter read DBG_FILTER again and decide on each site once more on
+// its next hit. Takes no lock, so it's called by the handler of SIGHUP too
+DBG_INLINE void ReloadFilter() {
+  filter_stale.store(true);
+  for (CallSite *site = decided_sites.load(std::memory_order_acquire);
+       site != nullptr; site = site->next_decided) {
+    site->filter_decision.store(FilterDecision::kUndecided);
+  }
+}
+
+#if defined(DBG_RELOAD_FILTER_ON_SIGHUP)
+// Call ReloadFilter() on SIGHUP, the handler is set before main()
+DBG_INLINE bool ReloadFilterOnSighup() {
+  struct sigaction action = {};
+  action.sa_handler = [](int) { ReloadFilter(); };
+  sigemptyset(&action.sa_mask);
+  action.sa_flags = SA_RESTART;
+  return sigaction(SIGHUP, &action, nullptr) == 0;
+}
+#endif
+#endif  // DBG_DEFINE_CORE
+
+
+#if defined(DBG_DEFINE_CORE)
+// Change the limits of all records
+DBG_INLINE void SetLimits(const Limits &limits) {
+  limit_elements.store(limits.elements, std::memory_order_relaxed);
+  limit_depth.store(limits.depth, std::memory_order_relaxed);
+  limit_bytes.store(limits.bytes, std::memory_order_relaxed);
+}
+
+// The limits of all records
+DBG_INLINE Limits GlobalLimits() {
+  return {limit_elements.load(std::memory_order_relaxed),
+          limit_depth.load(std::memory_order_relaxed),
+          limit_bytes.load(std::memory_order_relaxed)};
+}
+
+
+// Start the record in the context of the current thread with the header of
+// the writer, [<file>:<line> (<function>) <date> <time>] for the text one.
+// The limits that aren't set are taken from the global ones. The binary log
+// has the header written by RecordArgs() instead
+DBG_INLINE Context &BeginRecord(const CallSite &site, const Limits &limits) {
+  if (context_state != ContextState::kAlive) [[unlikely]] {
+    if (context_state == ContextState::kDestroyed) {
+      late_context_mutex.lock();
+      if (late_context == nullptr) {
+        late_context = new Context;
+      }
+      BeginRecord(*late_context, site, limits);
+      return *late_context;
+    }
+    context_guard.Touch();
+  }
+  BeginRecord(context, site, limits);
+  return context;
+}
+
+// Start the record in the given context, for the records that aren't made by
+// dbg() on the current thread
+DBG_INLINE void BeginRecord(Context &ctx, const CallSite &site,
+                            const Limits &limits) {
+  if constexpr (DBG_USAGE_TOP > 0) {
+    ctx.began = std::chrono::steady_clock::now();
+  }
+  ctx.limits = limits.Or(GlobalLimits());
+  ctx.truncated = false;
+  ctx.pointees.Clear();
+#if !defined(DBG_BINARY_LOG)
+  Writer::BeginRecord(ctx, site);
+#else
+  static_cast<void>(site);
+#endif
+}
+
+// Let the writer end the record collected in the context, pass it to the sink
+// and clear the buffer. dbg() calls it once the record is complete
+DBG_INLINE void CommitRecord(Context &ctx) {
+#if !defined(DBG_BINARY_LOG)
+  Writer::EndRecord(ctx);
+#endif
+  PassToSink(ctx.buffer.View());
+  DropRecord(ctx);
+}
+
+// CommitRecord() that counts the record, its bytes and the time since it was
+// begun into the usage of the call site the thread keeps in the slot. Nothing
+// is counted with DBG_USAGE_TOP 0
+DBG_INLINE void CommitRecord(Context &ctx, CallSite &site, LeaseSlot &usage) {
+#if !defined(DBG_BINARY_LOG)
+  Writer::EndRecord(ctx);
+#endif
+  if constexpr (DBG_USAGE_TOP > 0) {
+    auto elapsed = std::chrono::steady_clock::now() - ctx.began;
+    site.ThreadUsage(usage).Add(
+        ctx.buffer.View().size(),
+        std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+  }
+  PassToSink(ctx.buffer.View());
+  DropRecord(ctx);
+}
+
+// Forget the record begun in the context without passing it to the sink.
+// dbg_diff() calls it when nothing changed
+DBG_INLINE void DropRecord(Context &ctx) {
+  ctx.buffer.Clear();
+  if (&ctx == late_context) [[unlikely]] {
+    late_context_mutex.unlock();
+  }
+}
+
+// Pass the finished record to the sink, through the background writer with
+// DBG_ASYNC or right from the calling thread
+DBG_INLINE void PassToSink(std::string_view record) {
+#if defined(DBG_MAPPED_FILE) || defined(DBG_FLIGHT_RECORDER) ||                \
+    defined(DBG_SHARDED_LOG)
+  sink.Write(record);
+#elif defined(DBG_ASYNC)
+#if defined(DBG_WRITE_TO_SOCKET)
+  if (!async_writer.Admit(record.size())) {
+    dropped_records.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+#endif
+  RecordNode *node = async_writer.Node();
+  node->text.assign(record);
+  async_writer.Push(node);
+#else
+  std::lock_guard lock(sink_mutex);
+  WriteToSink(record);
+#endif
+}
+
+// Write out what's kept in the memory: the rings of the flight recorder or
+// whatever the sink holds. dbg_dump() calls it
+DBG_INLINE void Dump() {
+  ReportSummaries();
+#if defined(DBG_FLIGHT_RECORDER)
+  sink.Dump(false);
+#elif defined(DBG_MAPPED_FILE)
+  // The mapping is already the file
+#elif defined(DBG_SHARDED_LOG)
+  // The files of the other threads are theirs to flush
+  sink.Flush();
+#elif defined(DBG_ASYNC)
+  // The node without the text makes the writer flush
+  async_writer.Push(async_writer.Node());
+#else
+  std::lock_guard lock(sink_mutex);
+  FlushSink();
+#endif
+}
+#endif  // DBG_DEFINE_CORE
+
+
+// Count the duration. Must be called by the owner only
+inline void TimeHistogram::Add(uint64_t ns) {
+  std::atomic<uint64_t> &count = counts[Bucket(ns)];
+  count.store(count.load(std::memory_order_relaxed) + 1,
+              std::memory_order_relaxed);
+  if (ns > max.load(std::memory_order_relaxed)) {
+    max.store(ns, std::memory_order_relaxed);
+  }
+}
+
+// The bucket of the duration
+inline size_t TimeHistogram::Bucket(uint64_t ns) {
+  if (ns < kSubBuckets) {
+    return ns;
+  }
+  int shift = std::bit_width(ns) - 1 - kSubBits;
+  return (shift + 1) * kSubBuckets + ((ns >> shift) & (kSubBuckets - 1));
+}
+
+inline ScopeTimer::ScopeTimer(TimeHistogram &histogram, CallSite &site)
+    : histogram_(histogram) {
+  if (dbg_enabled && site.Selected()) {
+    start_ = std::chrono::steady_clock::now();
+  }
+}
+
+inline ScopeTimer::~ScopeTimer() {
+  if (start_ == std::chrono::steady_clock::time_point()) {
+    return;
+  }
+  auto elapsed = std::chrono::steady_clock::now() - start_;
+  histogram_.Add(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+}
+
+// The histogram of the calling thread kept in the slot, it's taken on the
+// first hit
+inline TimeHistogram &TimedSite::ThreadHistogram(LeaseSlot &slot) {
+  if (slot.item != nullptr) [[likely]] {
+    return *static_cast<TimeHistogram *>(slot.item);
+  }
+  return TakeHistogram(slot);
+}
+
+// Take the object for the calling thread into the slot: the first one given
+// back by the exited threads, or the new one if there is none
+template <class T>
+T &LeasedList<T>::Take(LeaseSlot &slot) {
+  T *item = head_.load(std::memory_order_acquire);
+  for (; item != nullptr; item = item->next) {
+    bool owned = false;
+    if (item->owned.compare_exchange_strong(owned, true,
+                                            std::memory_order_acquire)) {
+      break;
+    }
+  }
+  if (item == nullptr) {
+    item = new T;
+    item->owned.store(true, std::memory_order_relaxed);
+    item->next = head_.load(std::memory_order_relaxed);
+    while (!head_.compare_exchange_weak(item->next, item,
+                                        std::memory_order_release,
+                                        std::memory_order_relaxed)) {
+    }
+  }
+  HoldLease(slot, *item);
+  return *item;
+}
+
+#if defined(DBG_DEFINE_CORE)
+// Put the object into the slot and list it among the ones the thread gives
+// back on exit
+DBG_INLINE void HoldLease(LeaseSlot &slot, Leasable &item) {
+  slot.item = &item;
+  if (!thread_leases_gone) {
+    thread_leases.Add(slot);
+  }
+}
+
+// The figures the thread wrote reach the next owner along with the object
+DBG_INLINE ThreadLeases::~ThreadLeases() {
+  thread_leases_gone = true;
+  for (LeaseSlot *slot : slots_) {
+    slot->item->owned.store(false, std::memory_order_release);
+    slot->item = nullptr;
+  }
+}
+
+// The middle of the durations the bucket holds
+DBG_INLINE uint64_t TimeHistogram::BucketMiddle(size_t bucket) {
+  if (bucket < kSubBuckets) {
+    return bucket;
+  }
+  int shift = static_cast<int>(bucket / kSubBuckets) - 1;
+  uint64_t lowest = (kSubBuckets + bucket % kSubBuckets) << shift;
+  return lowest + ((uint64_t{1} << shift) >> 1);
+}
+
+// Take the histogram into the slot and list the site among the reported
+DBG_INLINE TimeHistogram &TimedSite::TakeHistogram(LeaseSlot &slot) {
+  TimeHistogram &histogram = histograms.Take(slot);
+  if (!registered.exchange(true, std::memory_order_relaxed)) {
+    next = timed_sites.load(std::memory_order_relaxed);
+    while (!timed_sites.compare_exchange_weak(next, this,
+                                              std::memory_order_release,
+                                              std::memory_order_relaxed)) {
+    }
+  }
+  return histogram;
+}
+
+// Make the record of the counts and the quantiles of each dbg_time() site,
+// merged across the threads. The figures are the ones since the start
+DBG_INLINE void ReportTimes(Context &ctx) {
+  static constexpr std::array<std::string_view, 5> kNames = {
+      "count", "p50_ns", "p90_ns", "p99_ns", "max_ns"};
+  static constexpr std::array<std::string_view, 6> kLabeledNames = {
+      "label", "count", "p50_ns", "p90_ns", "p99_ns", "max_ns"};
+
+  std::array<uint64_t, TimeHistogram::kBuckets> counts;
+  for (TimedSite *timed = timed_sites.load(std::memory_order_acquire);
+       timed != nullptr; timed = timed->next) {
+    counts.fill(0);
+    uint64_t total = 0;
+    uint64_t max = 0;
+    for (TimeHistogram *histogram = timed->histograms.Head();
+         histogram != nullptr; histogram = histogram->next) {
+      for (size_t i = 0; i < counts.size(); ++i) {
+        uint64_t count = histogram->counts[i].load(std::memory_order_relaxed);
+        counts[i] += count;
+        total += count;
+      }
+      max = std::max(max, histogram->max.load(std::memory_order_relaxed));
+    }
+    if (total == 0) {
+      continue;
+    }
+
+    // The durations don't exceed the max, the middle of its bucket may
+    auto quantile = [&](uint64_t percent) {
+      uint64_t rank = std::max<uint64_t>((total * percent + 99) / 100, 1);
+      size_t bucket = 0;
+      for (uint64_t seen = counts[0]; seen < rank; seen += counts[++bucket]) {
+      }
+      return std::min(TimeHistogram::BucketMiddle(bucket), max);
+    };
+    uint64_t p50 = quantile(50);
+    uint64_t p90 = quantile(90);
+    uint64_t p99 = quantile(99);
+
+    BeginRecord(ctx, timed->site, {});
+    if (timed->label.empty()) {
+      RecordArgs(ctx, timed->site, kNames, total, p50, p90, p99, max);
+    } else {
+      RecordArgs(ctx, timed->site, kLabeledNames, timed->label, total, p50,
+                 p90, p99, max);
+    }
+    CommitRecord(ctx);
+  }
+}
+#endif  // DBG_DEFINE_CORE
+
+// Count the hit with the value. Must be called by the owner only
+template <class T>
+void CountShard<T>::Add(T x) {
+  if constexpr (std::is_integral_v<T> || std::is_enum_v<T>) {
+    using Underlying = typename std::conditional_t<std::is_enum_v<T>,
+                                                   std::underlying_type<T>,
+                                                   std::type_identity<T>>::type;
+    auto index = static_cast<uint64_t>(static_cast<Underlying>(x));
+    if (index < kDenseCounts) {
+      std::atomic<uint64_t> &count = dense[index];
+      count.store(count.load(std::memory_order_relaxed) + 1,
+                  std::memory_order_relaxed);
+      return;
+    }
+  }
+  std::lock_guard lock(mutex);
+  ++sparse[x];
+}
+
+// Count the hit. Must be called by the owner only
+inline void CountShard<NoKey>::Add() {
+  count.store(count.load(std::memory_order_relaxed) + 1,
+              std::memory_order_relaxed);
+}
+
+// The shard of the calling thread kept in the slot, it's taken on the first
+// hit
+template <class T>
+CountShard<T> &CountedSite<T>::ThreadShard(LeaseSlot &slot) {
+  if (slot.item != nullptr) [[likely]] {
+    return *static_cast<CountShard<T> *>(slot.item);
+  }
+  return TakeShard(slot);
+}
+
+// Take the shard into the slot and list the site among the reported
+template <class T>
+CountShard<T> &CountedSite<T>::TakeShard(LeaseSlot &slot) {
+  CountShard<T> &shard = shards_.Take(slot);
+  Register();
+  return shard;
+}
+
+// Make the record of the counts merged across the threads: the count of the
+// hits, or the map of the values to their counts
+template <class T>
+void CountedSite<T>::Report(Context &ctx) {
+  std::conditional_t<std::same_as<T, NoKey>, uint64_t, CountMap<T>>
+      counts{};
+  for (CountShard<T> *shard = shards_.Head();
+       shard != nullptr; shard = shard->next) {
+    if constexpr (std::same_as<T, NoKey>) {
+      counts += shard->count.load(std::memory_order_relaxed);
+    } else {
+      for (size_t i = 0; i < kDenseCounts; ++i) {
+        if (uint64_t count = shard->dense[i].load(std::memory_order_relaxed)) {
+          counts[static_cast<T>(i)] += count;
+        }
+      }
+      std::lock_guard lock(shard->mutex);
+      for (const auto &[value, count] : shard->sparse) {
+        counts[value] += count;
+      }
+    }
+  }
+
+  std::array<std::string_view, 1> names = {"count"};
+  if constexpr (!std::same_as<T, NoKey>) {
+    if (counts.empty()) {
+      return;
+    }
+    names[0] = expression_;
+  }
+  BeginRecord(ctx, site_, {});
+  RecordArgs(ctx, site_, names, counts);
+  CommitRecord(ctx);
+}
+
+#if defined(DBG_DEFINE_CORE)
+// Put the site into the list of the reported ones, once
+DBG_INLINE void CountedSiteBase::Register() {
+  if (registered_.exchange(true, std::memory_order_relaxed)) {
+    return;
+  }
+  next_ = counted_sites.load(std::memory_order_relaxed);
+  while (!counted_sites.compare_exchange_weak(next_, this,
+                                              std::memory_order_release,
+                                              std::memory_order_relaxed)) {
+  }
+}
+
+// Make the record of the counts of each dbg_count() site, merged across the
+// threads. The figures are the ones since the start
+DBG_INLINE void ReportCounts(Context &ctx) {
+  for (CountedSiteBase *counted = counted_sites.load(std::memory_order_acquire);
+       counted != nullptr; counted = counted->Next()) {
+    counted->Report(ctx);
+  }
+}
+
+
+// Make the records of the call sites that made the most bytes and of the ones
+// that spent the most time formatting, DBG_USAGE_TOP of each, merged across
+// the threads. The figures are the ones since the start
+DBG_INLINE void ReportUsage(Context &ctx) {
+  static constexpr std::array<std::string_view, 5> kNames = {
+      "top_by", "rank", "records", "bytes", "format_ns"};
+  struct Usage {
+    CallSite *site;
+    uint64_t records = 0;
+    uint64_t bytes = 0;
+    uint64_t format_ns = 0;
+  };
+
+  std::vector<Usage> usages;
+  for (CallSite *site = accounted_sites.load(std::memory_order_acquire);
+       site != nullptr; site = site->next_accounted) {
+    Usage &usage = usages.emplace_back(Usage{site});
+    for (SiteUsage *thread = site->usages.Head(); thread != nullptr;
+         thread = thread->next) {
+      usage.records += thread->records.load(std::memory_order_relaxed);
+      usage.bytes += thread->bytes.load(std::memory_order_relaxed);
+      usage.format_ns += thread->format_ns.load(std::memory_order_relaxed);
+    }
+    // The site of dbg_diff() is accounted before it finds what changed
+    if (usage.records == 0) {
+      usages.pop_back();
+    }
+  }
+
+#if defined(DBG_BINARY_LOG)
+  // The site entry of the binary log names the arguments of the records of
+  // the site, so the report is made at the copy of the site with its own one
+  static std::mutex usage_sites_mutex;
+  auto report_site = [](CallSite &site) -> CallSite & {
+    std::lock_guard lock(usage_sites_mutex);
+    if (site.usage_site == nullptr) {
+      site.usage_site = new CallSite{site.file, site.line, site.func};
+    }
+    return *site.usage_site;
+  };
+#else
+  auto report_site = [](CallSite &site) -> CallSite & { return site; };
+#endif
+
+  size_t top = std::min<size_t>(DBG_USAGE_TOP, usages.size());
+  auto report = [&](std::string_view by, uint64_t Usage::*figure) {
+    std::partial_sort(usages.begin(), usages.begin() + top, usages.end(),
+                      [&](const Usage &a, const Usage &b) {
+                        return a.*figure > b.*figure;
+                      });
+    for (size_t i = 0; i < top; ++i) {
+      const Usage &usage = usages[i];
+      CallSite &site = report_site(*usage.site);
+      BeginRecord(ctx, site, {});
+      RecordArgs(ctx, site, kNames, by, i + 1, usage.records, usage.bytes,
+                 usage.format_ns);
+      CommitRecord(ctx);
+    }
+  };
+  report("bytes", &Usage::bytes);
+  report("time", &Usage::format_ns);
+}
+
+
+// Make the records of dbg_time(), dbg_count() and the usage of the call sites.
+// dbg_dump() calls it
+DBG_INLINE void ReportSummaries() {
+  Context ctx;
+  ReportTimes(ctx);
+  ReportCounts(ctx);
+  ReportUsage(ctx);
+}
+
+// Reports the summaries on normal exit, before the sink is closed. The flight
+// recorder writes out only on crash or dbg_dump(), so it's not reported into
+DBG_INLINE SummariesAtExit::~SummariesAtExit() {
+#if !defined(DBG_FLIGHT_RECORDER)
+  ReportSummaries();
+#endif
+}
+#endif  // DBG_DEFINE_CORE
+
+
+inline DiffScope::DiffScope(Context &ctx, uint64_t id, bool marked)
+    : ctx_(ctx) {
+  if (ctx.diffing) {
+    Open(id, marked);
+  }
+}
+
+// The value identified by its name, e.g. the argument or the field. The name
+// is hashed only in the records of dbg_diff()
+inline DiffScope::DiffScope(Context &ctx, std::string_view name) : ctx_(ctx) {
+  if (ctx.diffing) {
+    Open(std::hash<std::string_view>{}(name), true);
+  }
+}
+
+// Start the span of the value in the record of dbg_diff()
+inline void DiffScope::Open(uint64_t id, bool marked) {
+  if (!marked) {
+    ctx_.diffing = false;
+    hidden_ = true;
+    return;
+  }
+  size_t parent = ctx_.diff_open;
+  uint64_t path = parent == kNoSpan ? 0 : ctx_.diff_spans[parent].path;
+  span_ = ctx_.diff_spans.size();
+  ctx_.diff_spans.push_back({.begin = ctx_.buffer.View().size(),
+                             .parent = parent,
+                             .path = CombineHashes(path, id)});
+  ctx_.diff_open = span_;
+}
+
+// The separator the writer put before the value isn't hashed, so the value
+// that becomes the first one of its block doesn't count as changed
+inline DiffScope::~DiffScope() {
+  if (hidden_) {
+    ctx_.diffing = true;
+  }
+  if (span_ == kNoSpan) {
+    return;
+  }
+  DiffSpan &span = ctx_.diff_spans[span_];
+  span.end = ctx_.buffer.View().size();
+  std::string_view text =
+      ctx_.buffer.View().substr(span.begin, span.end - span.begin);
+  if (text.starts_with(Writer::kElementSeparator)) {
+    text.remove_prefix(Writer::kElementSeparator.size());
+  }
+  span.hash = std::hash<std::string_view>{}(text);
+  ctx_.diff_open = span.parent;
+}
+
+// Identify the value by its key instead, printed since the given position
+inline void DiffScope::IdentifyByKey(size_t key_begin) {
+  if (span_ == kNoSpan) {
+    return;
+  }
+  DiffSpan &span = ctx_.diff_spans[span_];
+  uint64_t path =
+      span.parent == kNoSpan ? 0 : ctx_.diff_spans[span.parent].path;
+  std::string_view key = ctx_.buffer.View().substr(key_begin);
+  span.path = CombineHashes(path, std::hash<std::string_view>{}(key));
+}
+
+// Hash of the pair of hashes, the path of the value within its parent
+constexpr uint64_t CombineHashes(uint64_t parent, uint64_t id) {
+  return parent ^ (id + 0x9e3779b97f4a7c15 + (parent << 6) + (parent >> 2));
+}
+
+
+#if defined(DBG_DEFINE_CORE)
+// Compare the spans of the record with the last ones of the site and cut out
+// the unchanged values whose parents are shown, the binary log keeps all of
+// them. The hashes of the site become the ones of the record. Returns false if
+// none of the arguments changed
+DBG_INLINE bool LeaveOutUnchanged(Context &ctx, DiffSite &site) {
+  std::vector<DiffSpan> &spans = ctx.diff_spans;
+  bool changed = false;
+  site.next_hashes.clear();
+  for (DiffSpan &span : spans) {
+    auto last = std::ranges::lower_bound(
+        site.hashes, span.path, {}, &std::pair<uint64_t, uint64_t>::first);
+    span.changed = last == site.hashes.end() || last->first != span.path ||
+                   last->second != span.hash;
+    if (span.parent == kNoSpan) {
+      span.shown = true;
+      changed = changed || span.changed;
+    } else {
+      const DiffSpan &parent = spans[span.parent];
+      span.shown = parent.shown && parent.changed;
+    }
+    site.next_hashes.emplace_back(span.path, span.hash);
+  }
+  std::ranges::sort(site.next_hashes);
+  std::swap(site.hashes, site.next_hashes);
+  if (!changed) {
+    return false;
+  }
+
+#if !defined(DBG_BINARY_LOG)
+  // The kept text moves back over the cut out spans, they don't nest as the
+  // ones within them aren't shown. The separator of the value that becomes
+  // the first one of its block is cut out too
+  size_t to = 0;
+  size_t from = 0;
+  auto keep = [&ctx, &to, &from](size_t end) {
+    std::string_view text = ctx.buffer.View();
+    if (to != from && to > 0 && (text[to - 1] == '[' || text[to - 1] == '{') &&
+        text.substr(from, end - from).starts_with(Writer::kElementSeparator)) {
+      from += Writer::kElementSeparator.size();
+    }
+    ctx.buffer.MoveBack(to, from, end - from);
+    to += end - from;
+  };
+  for (const DiffSpan &span : spans) {
+    if (span.shown && !span.changed) {
+      keep(span.begin);
+      from = span.end;
+    }
+  }
+  keep(ctx.buffer.View().size());
+  ctx.buffer.Truncate(to);
+#endif
+  return true;
+}
+#endif  // DBG_DEFINE_CORE
+
+
+#if defined(DBG_DEFINE_CORE)
+// Prints current time in form of <dd.mm.yy HH:MM:SS>. The text is cached per
+// thread and refreshed when the second changes.
+// With DBG_MONOTONIC_TIME defined prints <seconds>.<nanoseconds> of
+// steady_clock instead, the same clock tracing spans are stamped with
+DBG_INLINE void PrintCurrTime(Context &ctx) {
+#if defined(DBG_MONOTONIC_TIME)
+  auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch())
+                .count();
+  std::array<char, 32> text;
+  char *end = std::to_chars(text.data(), text.data() + 20, ns / 1000000000).ptr;
+  *end++ = '.';
+  auto fraction = ns % 1000000000;
+  for (int i = 8; i >= 0; --i, fraction /= 10) {
+    end[i] = static_cast<char>('0' + fraction % 10);
+  }
+  ctx.out.write(text.data(), end + 9 - text.data());
+#else
+  std::time_t timestamp = std::time(nullptr);
+  if (timestamp != ctx.time_second) {
+    // std::localtime shares the result between threads
+    std::tm now{};
+#if defined(_MSC_VER)
+    localtime_s(&now, &timestamp);
+#else
+    localtime_r(&timestamp, &now);
+#endif
+    auto put = [&ctx](size_t pos, int value, char delim) {
+      ctx.time_text[pos] = static_cast<char>('0' + value / 10 % 10);
+      ctx.time_text[pos + 1] = static_cast<char>('0' + value % 10);
+      if (pos + 2 < ctx.time_text.size()) {
+        ctx.time_text[pos + 2] = delim;
+      }
+    };
+    put(0, now.tm_mday, '.');
+    put(3, now.tm_mon + 1, '.');
+    put(6, now.tm_year % 100, ' ');
+    put(9, now.tm_hour, ':');
+    put(12, now.tm_min, ':');
+    put(15, now.tm_sec, ' ');
+    ctx.time_second = timestamp;
+  }
+  ctx.out.write(ctx.time_text.data(), ctx.time_text.size());
+#endif
+}
+#endif  // DBG_DEFINE_CORE
+
+
+// Format arithmetic value into [first, last) as the stream does by default,
+// returns the end of the text. With DBG_ROUND_TRIP_FLOATS defined floating
+// point numbers are formatted in the shortest form that reads back exactly
+template <class T>
+  requires is_arithmetic<T>
+char *FormatArithmetic(char *first, char *last, T x) {
+  if constexpr (std::same_as<T, bool>) {
+    *first = x ? '1' : '0';
+    return first + 1;
+  } else if constexpr (is_narrow_char<T>) {
+    *first = static_cast<char>(x);
+    return first + 1;
+  } else if constexpr (std::is_floating_point_v<T>) {
+#if defined(DBG_ROUND_TRIP_FLOATS)
+    return std::to_chars(first, last, x).ptr;
+#else
+    return std::to_chars(first, last, x, std::chars_format::general, 6).ptr;
+#endif
+  } else {
+    return std::to_chars(first, last, x).ptr;
+  }
+}
+
+// Print contiguous arithmetic values formatted into the chunks on the stack,
+// each chunk is appended to the record at once. The separator of the writer
+// goes before each value but the very first one. Returns false once the record
+// is exhausted
+template <class T>
+  requires is_arithmetic<T>
+bool PrintArithmeticValues(Context &ctx, const T *values, size_t count,
+                           bool first) {
+  if (ctx.Exhausted(false)) {
+    return false;
+  }
+  std::array<char, 4096> chunk;
+  // The chunk ends past the room left in the record by one value at most, so
+  // the size limit is exceeded by no more than that
+  auto chunk_end = [&] {
+    size_t size = chunk.size();
+    if (ctx.limits.bytes != 0) {
+      size = std::min(size, ctx.limits.bytes - ctx.buffer.View().size() +
+                                kMaxArithmeticLength + 2);
+    }
+    return chunk.data() + size;
+  };
+  char *pos = chunk.data();
+  char *end = chunk_end();
+  for (size_t i = 0; i < count; ++i) {
+    if (end - pos < static_cast<ptrdiff_t>(kMaxArithmeticLength + 2)) {
+      ctx.buffer.Append(chunk.data(), pos - chunk.data());
+      if (ctx.Exhausted(false)) {
+        return false;
+      }
+      pos = chunk.data();
+      end = chunk_end();
+    }
+    if (!first || i > 0) {
+      pos = std::ranges::copy(Writer::kElementSeparator, pos).out;
+    }
+    pos = FormatArithmetic(pos, end, values[i]);
+  }
+  ctx.buffer.Append(chunk.data(), pos - chunk.data());
+  return true;
+}
+
+// Count of the elements printed from each end of the container of given size
+inline size_t ShownAtEachEnd(const Context &ctx, size_t size) {
+  size_t shown = ctx.limits.elements;
+  return (shown != 0 && size > 2 * shown) ? shown : size;
+}
+
+// Format 16 bytes into 32 hex digits and 16 chars, the unprintable ones are
+// '.'. Takes SSE2 or NEON where there are, the lookup table otherwise
+inline void FormatHex(const unsigned char *bytes, char *hex, char *chars) {
+#if defined(__SSE2__)
+  // The digit of each nibble is '0' + n, and 'a' - '0' - 10 more past 9
+  auto digits = [](__m128i nibbles) {
+    __m128i letters = _mm_and_si128(_mm_cmpgt_epi8(nibbles, _mm_set1_epi8(9)),
+                                    _mm_set1_epi8('a' - '0' - 10));
+    return _mm_add_epi8(_mm_add_epi8(nibbles, _mm_set1_epi8('0')), letters);
+  };
+  __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(bytes));
+  __m128i low_nibbles = _mm_set1_epi8(0x0f);
+  __m128i high = digits(_mm_and_si128(_mm_srli_epi16(x, 4), low_nibbles));
+  __m128i low = digits(_mm_and_si128(x, low_nibbles));
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(hex),
+                   _mm_unpacklo_epi8(high, low));
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(hex + 16),
+                   _mm_unpackhi_epi8(high, low));
+
+  // The signed comparison leaves out 0x80 and above too
+  __m128i printable =
+      _mm_and_si128(_mm_cmpgt_epi8(x, _mm_set1_epi8(0x1f)),
+                    _mm_cmplt_epi8(x, _mm_set1_epi8(0x7f)));
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(chars),
+                   _mm_or_si128(_mm_and_si128(printable, x),
+                                _mm_andnot_si128(printable,
+                                                 _mm_set1_epi8('.'))));
+#elif defined(__ARM_NEON)
+  auto digits = [](uint8x16_t nibbles) {
+    uint8x16_t letters = vandq_u8(vcgtq_u8(nibbles, vdupq_n_u8(9)),
+                                  vdupq_n_u8('a' - '0' - 10));
+    return vaddq_u8(vaddq_u8(nibbles, vdupq_n_u8('0')), letters);
+  };
+  uint8x16_t x = vld1q_u8(bytes);
+  uint8x16x2_t pairs = {
+      {digits(vshrq_n_u8(x, 4)), digits(vandq_u8(x, vdupq_n_u8(0x0f)))}};
+  vst2q_u8(reinterpret_cast<uint8_t *>(hex), pairs);
+
+  uint8x16_t printable =
+      vandq_u8(vcgeq_u8(x, vdupq_n_u8(0x20)), vcleq_u8(x, vdupq_n_u8(0x7e)));
+  vst1q_u8(reinterpret_cast<uint8_t *>(chars),
+           vbslq_u8(printable, x, vdupq_n_u8('.')));
+#else
+  // Both digits of each byte at once
+  static constexpr auto kHexPairs = [] {
+    constexpr std::string_view kHex = "0123456789abcdef";
+    std::array<char, 512> pairs{};
+    for (size_t i = 0; i < 256; ++i) {
+      pairs[2 * i] = kHex[i >> 4];
+      pairs[2 * i + 1] = kHex[i & 15];
+    }
+    return pairs;
+  }();
+  for (size_t i = 0; i < kHexLineBytes; ++i) {
+    unsigned char c = bytes[i];
+    hex[2 * i] = kHexPairs[2 * c];
+    hex[2 * i + 1] = kHexPairs[2 * c + 1];
+    chars[i] = (c >= 0x20 && c < 0x7f) ? static_cast<char>(c) : '.';
+  }
+#endif
+}
+
+// Format the line of the hex dump of count <= 16 bytes at the given offset
+// into first, returns the end of the text:
+// 00000010  48 6f 73 74                                      |Host|
+inline char *FormatHexLine(char *first, const unsigned char *bytes,
+                           size_t count, size_t offset) {
+  // The last line is padded, so the kernel reads no further than the bytes
+  std::array<unsigned char, kHexLineBytes> padded{};
+  if (count < kHexLineBytes) {
+    std::copy_n(bytes, count, padded.data());
+    bytes = padded.data();
+  }
+  std::array<char, 2 * kHexLineBytes> hex;
+  std::array<char, kHexLineBytes> chars;
+  FormatHex(bytes, hex.data(), chars.data());
+
+  // 8 digits of the offset, 16 for the dumps past 4 GiB
+  constexpr std::string_view kHex = "0123456789abcdef";
+  auto rest = static_cast<uint64_t>(offset);
+  size_t digits = (rest >> 32) != 0 ? 16 : 8;
+  for (size_t i = digits; i-- > 0; rest >>= 4) {
+    first[i] = kHex[rest & 15];
+  }
+  first += digits;
+
+  *first++ = ' ';
+  for (size_t i = 0; i < kHexLineBytes; ++i) {
+    if (i % 8 == 0) {
+      *first++ = ' ';
+    }
+    if (i < count) {
+      first[0] = hex[2 * i];
+      first[1] = hex[2 * i + 1];
+    } else {
+      first[0] = first[1] = ' ';
+    }
+    first[2] = ' ';
+    first += 3;
+  }
+  *first++ = ' ';
+  *first++ = '|';
+  first = std::copy_n(chars.data(), count, first);
+  *first++ = '|';
+  *first++ = '\n';
+  return first;
+}
+
+
+// Start the record with the header [<file>:<line> (<function>) <date> <time>]
+inline void TextWriter::BeginRecord(Context &ctx, const CallSite &site) {
+  ctx.out << "[" << site.file << ":" << site.line << " (" << site.func << ") ";
+  PrintCurrTime(ctx);
+  ctx.out << "]\n";
+}
+
+inline void TextWriter::EndRecord(Context &) {
+}
+
+inline void TextWriter::BeginField(Context &ctx, std::string_view name,
+                                   std::string_view type) {
+  ctx.out << ctx.Indent() << name << ": " << type << " = ";
+}
+
+inline void TextWriter::EndField(Context &ctx) {
+  ctx.buffer.Append("\n", 1);
+}
+
+inline void TextWriter::BeginObject(Context &ctx) {
+  ctx.buffer.Append("{\n", 2);
+  ctx.IncreaseIndent();
+}
+
+inline void TextWriter::EndObject(Context &ctx) {
+  ctx.DecreaseIndent();
+  ctx.out << ctx.Indent() << "}";
+}
+
+inline void TextWriter::BeginRow(Context &ctx) {
+  ctx.buffer.Append("{", 1);
+}
+
+inline void TextWriter::RowElement(Context &ctx, size_t index) {
+  if (index > 0) {
+    ctx.buffer.Append(kElementSeparator.data(), kElementSeparator.size());
+  }
+}
+
+inline void TextWriter::RowSkipped(Context &ctx, size_t count) {
+  ctx.out << ", ... " << count << " more ...";
+}
+
+inline void TextWriter::EndRow(Context &ctx) {
+  ctx.buffer.Append("}", 1);
+}
+
+inline void TextWriter::BeginColumn(Context &ctx, std::string_view type) {
+  ctx.buffer.Append("{\n", 2);
+  ctx.IncreaseIndent();
+  ctx.out << ctx.Indent() << "<" << type << ">\n";
+}
+
+inline void TextWriter::BeginColumnElement(Context &ctx, size_t index) {
+  ctx.out << ctx.Indent() << "[" << index << "] = ";
+}
+
+inline void TextWriter::EndColumnElement(Context &ctx) {
+  ctx.buffer.Append("\n", 1);
+}
+
+inline void TextWriter::EndColumn(Context &ctx) {
+  ctx.DecreaseIndent();
+  ctx.out << ctx.Indent() << "}";
+}
+
+inline void TextWriter::BeginMap(Context &ctx, std::string_view key_type,
+                                 std::string_view value_type) {
+  ctx.buffer.Append("{\n", 2);
+  ctx.IncreaseIndent();
+  ctx.out << ctx.Indent() << "<" << key_type << " -> " << value_type << ">\n";
+}
+
+inline void TextWriter::BeginMapKey(Context &ctx) {
+  ctx.out << ctx.Indent() << "[";
+}
+
+inline void TextWriter::BeginMapValue(Context &ctx) {
+  ctx.buffer.Append("] = ", 4);
+}
+
+inline void TextWriter::EndMapValue(Context &ctx) {
+  ctx.buffer.Append("\n", 1);
+}
+
+inline void TextWriter::EndMap(Context &ctx) {
+  EndColumn(ctx);
+}
+
+inline void TextWriter::BeginBytes(Context &ctx, size_t size) {
+  if (size == 0) {
+    Empty(ctx);
+    return;
+  }
+  ctx.buffer.Append("{\n", 2);
+  ctx.IncreaseIndent();
+}
+
+// The lines are formatted into the chunk on the stack along with their
+// indentation, each chunk is appended to the record at once
+inline bool TextWriter::HexBytes(Context &ctx, const unsigned char *bytes,
+                                 size_t offset, size_t count) {
+  if (ctx.Exhausted(true)) {
+    return false;
+  }
+  std::array<char, 4096> chunk;
+  char *pos = chunk.data();
+  char *end = chunk.data() + chunk.size();
+  for (size_t i = offset; i < offset + count; i += kHexLineBytes) {
+    size_t indent = 2 * static_cast<size_t>(ctx.depth);
+    if (end - pos < static_cast<ptrdiff_t>(indent + kMaxHexLineLength)) {
+      ctx.buffer.Append(chunk.data(), pos - chunk.data());
+      pos = chunk.data();
+      if (ctx.Exhausted(true)) {
+        return false;
+      }
+    }
+    // The indentation of the block nested that deep doesn't fit the chunk
+    if (indent + kMaxHexLineLength > chunk.size()) {
+      ctx.out << ctx.Indent();
+      indent = 0;
+    }
+    for (size_t left = indent; left > 0;) {
+      size_t spaces = std::min(left, kSpaces.size());
+      pos = std::copy_n(kSpaces.data(), spaces, pos);
+      left -= spaces;
+    }
+    pos = FormatHexLine(pos, bytes + i,
+                        std::min(kHexLineBytes, offset + count - i), i);
+  }
+  ctx.buffer.Append(chunk.data(), pos - chunk.data());
+  return true;
+}
+
+inline void TextWriter::BytesSkipped(Context &ctx, size_t count) {
+  Skipped(ctx, count);
+}
+
+inline void TextWriter::EndBytes(Context &ctx, size_t size) {
+  if (size != 0) {
+    EndColumn(ctx);
+  }
+}
+
+inline void TextWriter::Skipped(Context &ctx, size_t count) {
+  ctx.out << ctx.Indent() << "... " << count << " more ...\n";
+}
+
+inline void TextWriter::Empty(Context &ctx) {
+  ctx.buffer.Append("{}", 2);
+}
+
+inline void TextWriter::BeginPointee(Context &ctx) {
+  ctx.buffer.Append("{", 1);
+}
+
+inline void TextWriter::EndPointee(Context &ctx) {
+  ctx.buffer.Append("}", 1);
+}
+
+inline void TextWriter::BeginClassPointee(Context &ctx,
+                                          std::string_view prefix,
+                                          std::string_view type,
+                                          const void *address) {
+  ctx.IncreaseIndent();
+  ctx.out << "{\n" << ctx.Indent() << "<" << prefix << type;
+  if (address != nullptr) {
+    ctx.out << " @" << address;
+  }
+  ctx.out << ">\n" << ctx.Indent();
+}
+
+inline void TextWriter::EndClassPointee(Context &ctx) {
+  ctx.DecreaseIndent();
+  ctx.out << "\n" << ctx.Indent() << "}";
+}
+
+inline void TextWriter::SeenPointee(Context &ctx, const void *address) {
+  ctx.out << "<see @" << address << ">";
+}
+
+inline void TextWriter::Null(Context &ctx) {
+  ctx.buffer.Append("nullptr", 7);
+}
+
+inline void TextWriter::TooDeep(Context &ctx) {
+  ctx.buffer.Append("{...}", 5);
+}
+
+inline void TextWriter::Truncated(Context &ctx, bool own_line) {
+  if (own_line) {
+    ctx.out << ctx.Indent() << "... truncated ...\n";
+  } else {
+    ctx.out << " ... truncated ...";
+  }
+}
+
+// Scalar type like int, float or char. Arithmetic ones are formatted
+// without the stream, the enums it can't print as their underlying values
+template <class T>
+void TextWriter::Scalar(Context &ctx, T x) {
+  if constexpr (is_arithmetic<T>) {
+    std::array<char, kMaxArithmeticLength> text;
+    char *end = FormatArithmetic(text.data(), text.data() + text.size(), x);
+    ctx.buffer.Append(text.data(), end - text.data());
+  } else if constexpr (std::is_enum_v<T> && !is_streamable<T>) {
+    Scalar(ctx, static_cast<std::underlying_type_t<T>>(x));
+  } else {
+    ctx.out << x;
+  }
+}
+
+inline void TextWriter::String(Context &ctx, std::string_view x) {
+  ctx.buffer.Append("\"", 1);
+  ctx.buffer.Append(x.data(), x.size());
+  ctx.buffer.Append("\"", 1);
+}
+
+
+// Start the JSON line with the fields of the site and the time, the arguments
+// follow in the array
+inline void JsonWriter::BeginRecord(Context &ctx, const CallSite &site) {
+  ctx.out << "{\"file\":";
+  String(ctx, site.file);
+  ctx.out << ",\"line\":" << site.line << ",\"func\":";
+  String(ctx, site.func);
+  ctx.out << ",\"time\":\"";
+  PrintCurrTime(ctx);
+  ctx.out << "\",\"args\":[";
+}
+
+inline void JsonWriter::EndRecord(Context &ctx) {
+  ctx.buffer.Append("]", 1);
+  if (ctx.truncated) {
+    ctx.out << ",\"truncated\":true";
+  }
+  ctx.buffer.Append("}\n", 2);
+}
+
+inline void JsonWriter::BeginField(Context &ctx, std::string_view name,
+                                   std::string_view type) {
+  Separate(ctx);
+  if (ctx.depth == 0) {
+    ctx.out << "{\"name\":";
+    String(ctx, name);
+    ctx.out << ",\"type\":";
+    String(ctx, type);
+    ctx.out << ",\"value\":";
+  } else {
+    String(ctx, name);
+    ctx.buffer.Append(":", 1);
+  }
+}
+
+inline void JsonWriter::EndField(Context &ctx) {
+  if (ctx.depth == 0) {
+    ctx.buffer.Append("}", 1);
+  }
+}
+
+inline void JsonWriter::BeginObject(Context &ctx) {
+  ctx.buffer.Append("{", 1);
+  ctx.IncreaseIndent();
+}
+
+inline void JsonWriter::EndObject(Context &ctx) {
+  ctx.DecreaseIndent();
+  ctx.buffer.Append("}", 1);
+}
+
+inline void JsonWriter::BeginRow(Context &ctx) {
+  ctx.buffer.Append("[", 1);
+}
+
+inline void JsonWriter::RowElement(Context &ctx, size_t) {
+  Separate(ctx);
+}
+
+inline void JsonWriter::RowSkipped(Context &ctx, size_t count) {
+  Skipped(ctx, count);
+}
+
+inline void JsonWriter::EndRow(Context &ctx) {
+  ctx.buffer.Append("]", 1);
+}
+
+inline void JsonWriter::BeginColumn(Context &ctx, std::string_view) {
+  ctx.buffer.Append("[", 1);
+  ctx.IncreaseIndent();
+}
+
+inline void JsonWriter::BeginColumnElement(Context &ctx, size_t) {
+  Separate(ctx);
+}
+
+inline void JsonWriter::EndColumnElement(Context &) {
+}
+
+inline void JsonWriter::EndColumn(Context &ctx) {
+  ctx.DecreaseIndent();
+  ctx.buffer.Append("]", 1);
+}
+
+inline void JsonWriter::BeginMap(Context &ctx, std::string_view,
+                                 std::string_view) {
+  BeginColumn(ctx, {});
+}
+
+inline void JsonWriter::BeginMapKey(Context &ctx) {
+  Separate(ctx);
+  ctx.buffer.Append("[", 1);
+}
+
+inline void JsonWriter::BeginMapValue(Context &ctx) {
+  ctx.buffer.Append(",", 1);
+}
+
+inline void JsonWriter::EndMapValue(Context &ctx) {
+  ctx.buffer.Append("]", 1);
+}
 
+inline void JsonWriter::EndMap(Context &ctx) {
+  EndColumn(ctx);
+}
 
-// Print std::unordered_set of scalars
-template <class T>
-  requires is_scalar<T>
-void PrettyPrint(const std::unordered_set<T> &x);
+inline void JsonWriter::BeginBytes(Context &ctx, size_t) {
+  ctx.buffer.Append("\"", 1);
+}
 
-// Print std::unordered_set of class objects
-template <class T>
-  requires is_class<T>
-void PrettyPrint(const std::unordered_set<T> &x);
+// The digits are formatted into the chunk on the stack, each chunk is appended
+// to the record at once
+inline bool JsonWriter::HexBytes(Context &ctx, const unsigned char *bytes,
+                                 size_t offset, size_t count) {
+  if (ctx.Exhausted(false)) {
+    return false;
+  }
+  std::array<char, 4096> chunk;
+  std::array<unsigned char, kHexLineBytes> padded{};
+  std::array<char, kHexLineBytes> chars;
+  char *pos = chunk.data();
+  char *end = chunk.data() + chunk.size();
+  for (size_t i = offset; i < offset + count; i += kHexLineBytes) {
+    if (end - pos < static_cast<ptrdiff_t>(2 * kHexLineBytes)) {
+      ctx.buffer.Append(chunk.data(), pos - chunk.data());
+      pos = chunk.data();
+      if (ctx.Exhausted(false)) {
+        return false;
+      }
+    }
+    // The last bytes are padded, so the kernel reads no further than them
+    size_t n = std::min(kHexLineBytes, offset + count - i);
+    const unsigned char *line = bytes + i;
+    if (n < kHexLineBytes) {
+      std::copy_n(line, n, padded.data());
+      line = padded.data();
+    }
+    FormatHex(line, pos, chars.data());
+    pos += 2 * n;
+  }
+  ctx.buffer.Append(chunk.data(), pos - chunk.data());
+  return true;
+}
 
+inline void JsonWriter::BytesSkipped(Context &ctx, size_t count) {
+  ctx.out << " ... " << count << " more ... ";
+}
 
-// Print std::map regargdell keys and values are scalars or class objects
-template <class K, class V>
-void PrettyPrint(const std::map<K, V> &x);
+inline void JsonWriter::EndBytes(Context &ctx, size_t) {
+  ctx.buffer.Append("\"", 1);
+}
 
+inline void JsonWriter::Skipped(Context &ctx, size_t count) {
+  Separate(ctx);
+  ctx.out << "\"... " << count << " more ...\"";
+}
 
-// Print std::unordered_map regargdell keys and values are scalars or classes
-template <class K, class V>
-void PrettyPrint(const std::unordered_map<K, V> &x);
+inline void JsonWriter::Empty(Context &ctx) {
+  ctx.buffer.Append("[]", 2);
+}
 
+inline void JsonWriter::BeginPointee(Context &) {
+}
 
-// Print unique pointer to scalar
-template <class T>
-  requires is_scalar<T>
-void PrettyPrint(const std::unique_ptr<T> &x);
+inline void JsonWriter::EndPointee(Context &) {
+}
 
-// Print unique pointer to class
-template <class T>
-  requires is_class<T>
-void PrettyPrint(const std::unique_ptr<T> &x);
+inline void JsonWriter::BeginClassPointee(Context &ctx, std::string_view,
+                                          std::string_view, const void *) {
+  ctx.IncreaseIndent();
+}
 
+inline void JsonWriter::EndClassPointee(Context &ctx) {
+  ctx.DecreaseIndent();
+}
 
-// Print shared pointer to scalar
-template <class T>
-  requires is_scalar<T>
-void PrettyPrint(const std::shared_ptr<T> &x);
+inline void JsonWriter::SeenPointee(Context &ctx, const void *address) {
+  ctx.out << "\"<see @" << address << ">\"";
+}
 
-// Print shared pointer to class
-template <class T>
-  requires is_class<T>
-void PrettyPrint(const std::shared_ptr<T> &x);
+inline void JsonWriter::Null(Context &ctx) {
+  ctx.buffer.Append("null", 4);
+}
 
+inline void JsonWriter::TooDeep(Context &ctx) {
+  ctx.buffer.Append("\"{...}\"", 7);
+}
 
-// Parse single C-string into argument names that DERIVE_DEBUG was called with
-// DERIVE_DEBUG can be called with fields, expressions and method calls, for
-// instance: DERIVE_DEBUG(a, b + c, (Method(a, b))). In order to correctly split
-// on ["a", "b + c", "Method(a, b)"], not ["a", "b + c", "Method(a", "b)"],
-// the method callings should be enclosed in parentheses.
-class ArgNames {
- public:
-  ArgNames(const char *args) : args_(args) {
-  }
+inline void JsonWriter::Truncated(Context &, bool) {
+}
 
-  std::string pop() {
-    for (; idx_ < args_.size() and isspace(args_[idx_]); ++idx_) {
-    }
-    if (idx_ == args_.size()) {
-      return "";
+// Numbers as they are, so are the enums the stream can't print. Anything else
+// that isn't a C string is quoted as the stream prints it: pointers, enums
+// and nullptr
+template <class T>
+void JsonWriter::Scalar(Context &ctx, T x) {
+  if constexpr (std::same_as<T, bool>) {
+    ctx.out << (x ? "true" : "false");
+  } else if constexpr (is_narrow_char<T>) {
+    char c = static_cast<char>(x);
+    String(ctx, {&c, 1});
+  } else if constexpr (std::is_floating_point_v<T>) {
+    if (!std::isfinite(x)) {
+      ctx.buffer.Append("null", 4);
+      return;
     }
+    TextWriter::Scalar(ctx, x);
+  } else if constexpr (is_arithmetic<T>) {
+    TextWriter::Scalar(ctx, x);
+  } else if constexpr (std::same_as<T, const char *> ||
+                       std::same_as<T, char *>) {
+    String(ctx, x);
+  } else if constexpr (std::is_enum_v<T> && !is_streamable<T>) {
+    Scalar(ctx, static_cast<std::underlying_type_t<T>>(x));
+  } else {
+    ctx.out << "\"" << x << "\"";
+  }
+}
 
-    std::string name;
-    if (args_[idx_] == '(') {
-      int lvl = 1, end = idx_ + 1;
-      for (; end < args_.size(); ++end) {
-        if (args_[end] == '(') {
-          ++lvl;
-        } else if (args_[end] == ')') {
-          --lvl;
-        }
-
-        if (lvl == 0) {
-          break;
-        }
-      }
-      name = args_.substr(idx_ + 1, end - idx_ - 1);
-      for (; end < args_.size() and args_[end] != ','; ++end) {
-      }
-      idx_ = end + 1;
-
+// Quoted, with the quotes, the backslashes and the control chars escaped
+inline void JsonWriter::String(Context &ctx, std::string_view x) {
+  constexpr std::string_view kHex = "0123456789abcdef";
+  ctx.buffer.Append("\"", 1);
+  size_t plain = 0;
+  for (size_t i = 0; i < x.size(); ++i) {
+    auto c = static_cast<unsigned char>(x[i]);
+    if (c >= 0x20 && c != '"' && c != '\\') {
+      continue;
+    }
+    ctx.buffer.Append(x.data() + plain, i - plain);
+    plain = i + 1;
+    if (c == '"' || c == '\\') {
+      char escaped[] = {'\\', static_cast<char>(c)};
+      ctx.buffer.Append(escaped, 2);
+    } else if (c == '\n') {
+      ctx.buffer.Append("\\n", 2);
+    } else if (c == '\t') {
+      ctx.buffer.Append("\\t", 2);
     } else {
-      int end = idx_ + 1;
-      for (; end < args_.size() and args_[end] != ','; ++end) {
-      }
-      name = args_.substr(idx_, end - idx_);
-      idx_ = end + 1;
+      char escaped[] = {'\\', 'u', '0', '0', kHex[c >> 4], kHex[c & 15]};
+      ctx.buffer.Append(escaped, 6);
     }
+  }
+  ctx.buffer.Append(x.data() + plain, x.size() - plain);
+  ctx.buffer.Append("\"", 1);
+}
 
-    return name;
+// The comma before the element, unless it's the first one in its block
+inline void JsonWriter::Separate(Context &ctx) {
+  std::string_view text = ctx.buffer.View();
+  if (!text.empty() && text.back() != '[' && text.back() != '{') {
+    ctx.buffer.Append(",", 1);
   }
+}
 
- private:
-  std::string args_;
-  int idx_ = 0;
-};
 
+#if defined(DBG_BINARY_LOG)
+// Serializes taking the ids of the call sites and the last taken one
+inline std::mutex binary_sites_mutex;
+inline uint32_t binary_sites = 0;
 
-// Call the PrettyPrint on the last argument from the given variadic list
-// assigning it the top name from ArgNames.
-template <class T>
-void MultiplexPrettyPrintOnNamedArgs(ArgNames &names, const T &last) {
-  out << indent << names.pop() << ": ";
-  PrintTypeName(last);
-  out << " = ";
-  PrettyPrint(last);
-  out << "\n";
+// Flags of the header this file is configured for
+constexpr uint8_t BinaryFlags() {
+  uint8_t flags = 0;
+#if defined(DBG_MONOTONIC_TIME)
+  flags |= kMonotonicTimeFlag;
+#endif
+#if defined(DBG_ROUND_TRIP_FLOATS)
+  flags |= kRoundTripFloatsFlag;
+#endif
+  return flags;
 }
 
-// Call the PrettyPrint on the first argument from the given variadic list
-// assigning it the top name from ArgNames. The following call reduces argument
-// list by one
-template <class T, class... Args>
-void MultiplexPrettyPrintOnNamedArgs(ArgNames &names, const T &first,
-                                     const Args &...args) {
-  out << indent << names.pop() << ": ";
-  PrintTypeName(first);
-  out << " = ";
-  PrettyPrint(first);
-  out << "\n";
-  MultiplexPrettyPrintOnNamedArgs(names, args...);
+#if defined(DBG_DEFINE_CORE)
+// Header of the binary log, written before the first entry
+DBG_INLINE std::string_view BinaryHeader() {
+  static const std::string header = [] {
+    RecordBuffer buffer;
+    buffer.Append(kBinaryMagic.data(), kBinaryMagic.size());
+    AppendRaw(buffer, kBinaryVersion);
+    AppendRaw(buffer, BinaryFlags());
+    AppendRaw(buffer, kBinaryByteOrder);
+    return std::string(buffer.View());
+  }();
+  return header;
 }
 
-// Parse single C-string into argument names that dbg or DERIVE_DEBUG was called
-// with and start calling PrettyPrint on the arguments one by one
-template <class... Args>
-void MultiplexPrettyPrintOnVaArgs(const char *names, const Args &...args) {
-  ArgNames arg_names(names);
-  MultiplexPrettyPrintOnNamedArgs(arg_names, args...);
+// Time of the record in nanoseconds
+DBG_INLINE int64_t BinaryTime() {
+#if defined(DBG_MONOTONIC_TIME)
+  auto now = std::chrono::steady_clock::now();
+#else
+  auto now = std::chrono::system_clock::now();
+#endif
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             now.time_since_epoch())
+      .count();
 }
+#endif  // DBG_DEFINE_CORE
 
-}  // namespace __dbg_internal
+// Append the bytes of the value as it's kept in the memory
+template <class T>
+void AppendRaw(RecordBuffer &buffer, const T &x) {
+  buffer.Append(reinterpret_cast<const char *>(&x), sizeof(x));
+}
 
+// Append str: the size and the chars
+inline void AppendString(RecordBuffer &buffer, std::string_view text) {
+  AppendRaw(buffer, static_cast<uint64_t>(text.size()));
+  buffer.Append(text.data(), text.size());
+}
 
-// Print the debug information in the following form:
-// [<file>:<line> (<function>) <date> <time>]
-// <variable>: <type> = <pretty-printed variable>
-// This is repeated for each nested variable with the nice indentation
-#define dbg(...)                                                             \
-  if (__dbg_internal::dbg_enabled) {                                         \
-    if (__dbg_internal::dbg_was_called)                                      \
-      __dbg_internal::out << "\n";                                           \
-    __dbg_internal::dbg_was_called = true;                                   \
-    __dbg_internal::out << "[" << __FILE__ << ":" << __LINE__ << " ("        \
-                        << __func__ << ") ";                                 \
-    __dbg_internal::PrintCurrTime();                                         \
-    __dbg_internal::out << "]\n";                                            \
-    __dbg_internal::MultiplexPrettyPrintOnVaArgs(#__VA_ARGS__, __VA_ARGS__); \
-    std::flush(__dbg_internal::out);                                         \
+// Code of the type the arithmetic value is written raw as
+template <class T>
+  requires is_arithmetic<T>
+constexpr ScalarCode ScalarCodeOf() {
+  if constexpr (std::same_as<T, bool>) {
+    return ScalarCode::kBool;
+  } else if constexpr (is_narrow_char<T>) {
+    return ScalarCode::kChar;
+  } else if constexpr (std::same_as<T, float>) {
+    return ScalarCode::kFloat;
+  } else if constexpr (std::is_floating_point_v<T>) {
+    return ScalarCode::kDouble;
+  } else {
+    constexpr int kLog2Size = std::countr_zero(sizeof(T));
+    constexpr auto kFirst =
+        std::is_signed_v<T> ? ScalarCode::kInt8 : ScalarCode::kUInt8;
+    return static_cast<ScalarCode>(static_cast<uint8_t>(kFirst) + kLog2Size);
   }
+}
 
+// Append the arithmetic values converted to the types of their code
+template <class T>
+  requires is_arithmetic<T>
+void AppendScalars(RecordBuffer &buffer, const T *values, size_t count) {
+  if constexpr (std::same_as<T, bool>) {
+    for (size_t i = 0; i < count; ++i) {
+      AppendRaw(buffer, static_cast<uint8_t>(values[i]));
+    }
+  } else if constexpr (std::same_as<T, long double>) {
+    for (size_t i = 0; i < count; ++i) {
+      AppendRaw(buffer, static_cast<double>(values[i]));
+    }
+  } else {
+    buffer.Append(reinterpret_cast<const char *>(values), count * sizeof(T));
+  }
+}
 
-// Generate the PrettyPrint() method within class, that will called from
-// __dbg_internal::PrettyPrint function for user-defined classes.
-// DERIVE_DEBUG can be called with fields, expressions and method calls, for
-// instance: DERIVE_DEBUG(a, b + c, (Method(a, b))). In order to correctly split
-// on ["a", "b + c", "Method(a, b)"], not ["a", "b + c", "Method(a", "b)"],
-// the method callings should be enclosed in parentheses.
-#define DERIVE_DEBUG(...)                                                    \
-  void PrettyPrint() {                                                       \
-    __dbg_internal::out << "{\n";                                            \
-    __dbg_internal::IncreaseIndent();                                        \
-    __dbg_internal::MultiplexPrettyPrintOnVaArgs(#__VA_ARGS__, __VA_ARGS__); \
-    __dbg_internal::DecreaseIndent();                                        \
-    __dbg_internal::out << __dbg_internal::indent << "}";                    \
-    std::flush(__dbg_internal::out);                                         \
+// Id of the call site in the binary log. On the first record of the site
+// takes the next id and passes the site entry to the sink
+template <size_t N, class... Args>
+uint32_t BinarySiteId(CallSite &site,
+                      const std::array<std::string_view, N> &names,
+                      const Args &...) {
+  uint32_t id = site.binary_id.load(std::memory_order_acquire);
+  if (id != 0) {
+    return id;
   }
 
+  // The entry reaches the sink before the id is published, so the records of
+  // the other threads can't outrun it
+  std::lock_guard lock(binary_sites_mutex);
+  id = site.binary_id.load(std::memory_order_relaxed);
+  if (id == 0) {
+    id = ++binary_sites;
+    RecordBuffer entry;
+    AppendRaw(entry, EntryTag::kSite);
+    AppendRaw(entry, id);
+    AppendRaw(entry, static_cast<uint32_t>(site.line));
+    AppendString(entry, site.file);
+    AppendString(entry, site.func);
+    AppendRaw(entry, static_cast<uint32_t>(sizeof...(Args)));
+    const std::string_view *name = names.data();
+    ((AppendString(entry, *name++), AppendString(entry, TypeName<Args>())),
+     ...);
+    PassToSink(entry.View());
+    site.binary_id.store(id, std::memory_order_release);
+  }
+  return id;
+}
 
-// This provides the ability of turning off debugging on some areas of code
-#define DISABLE_DEBUG __dbg_internal::dbg_enabled = false;
-#define ENABLE_DEBUG __dbg_internal::dbg_enabled = true;
+// Write the value into the binary record, the raw bytes when it's one of the
+// ValueTag kinds and the text printed by PrettyPrint() otherwise. The limit of
+// elements applies to the raw arrays too, the one of bytes to the text only
+template <class T>
+void PrintBinaryValue(Context &ctx, const T &x) {
+  if constexpr (std::same_as<T, std::string> ||
+                std::same_as<T, std::string_view>) {
+    AppendRaw(ctx.buffer, ValueTag::kString);
+    AppendString(ctx.buffer, x);
+  } else if constexpr (is_arithmetic<T>) {
+    AppendRaw(ctx.buffer, ValueTag::kScalar);
+    AppendRaw(ctx.buffer, ScalarCodeOf<T>());
+    AppendScalars(ctx.buffer, &x, 1);
+  } else if constexpr (is_raw_array<T>) {
+    using Value = std::ranges::range_value_t<const T>;
+    const Value *data = std::ranges::data(x);
+    size_t size = std::ranges::size(x);
+    size_t edge = ShownAtEachEnd(ctx, size);
+    AppendRaw(ctx.buffer, ValueTag::kArray);
+    AppendRaw(ctx.buffer, ScalarCodeOf<Value>());
+    AppendRaw(ctx.buffer, static_cast<uint64_t>(size));
+    AppendRaw(ctx.buffer, static_cast<uint64_t>(edge));
+    AppendScalars(ctx.buffer, data, edge);
+    if (edge < size) {
+      AppendScalars(ctx.buffer, data + size - edge, edge);
+    }
+  } else {
+    AppendRaw(ctx.buffer, ValueTag::kText);
+    size_t at = ctx.buffer.View().size();
+    AppendRaw(ctx.buffer, uint64_t{0});
+    PrettyPrint(ctx, x);
+    uint64_t size = ctx.buffer.View().size() - at - sizeof(uint64_t);
+    ctx.buffer.Overwrite(at, reinterpret_cast<const char *>(&size),
+                         sizeof(size));
+  }
+}
+#endif
 
 
-// implementation
-namespace __dbg_internal {
+// Call print(element, index) on the elements of the range that fit into the
+// limits and skip(count) in place of the ones in between, the skipped elements
+// aren't visited. Stops once the record is exhausted. The size of the range
+// that is passed only once is known at its end, so the elements of both ends
+// are shown from its start and the rest is counted
+template <class R, class Print, class Skip>
+void ForEachShown(Context &ctx, const R &x, bool own_line, Print print,
+                  Skip skip) {
+  if constexpr (!std::ranges::forward_range<const R>) {
+    size_t shown = ctx.limits.elements != 0 ? 2 * ctx.limits.elements
+                                            : SIZE_MAX;
+    auto it = std::ranges::begin(x);
+    for (size_t i = 0; i < shown && it != std::ranges::end(x); ++i, ++it) {
+      if (ctx.Exhausted(own_line)) {
+        return;
+      }
+      print(*it, i);
+    }
+    size_t skipped = 0;
+    for (; it != std::ranges::end(x); ++it) {
+      ++skipped;
+    }
+    if (skipped != 0) {
+      skip(skipped);
+    }
+  } else {
+    size_t size = static_cast<size_t>(std::ranges::distance(x));
+    size_t edge = ShownAtEachEnd(ctx, size);
+
+    auto it = std::ranges::begin(x);
+    for (size_t i = 0; i < edge; ++i, ++it) {
+      if (ctx.Exhausted(own_line)) {
+        return;
+      }
+      print(*it, i);
+    }
+    if (edge == size) {
+      return;
+    }
 
-// Add two spaces to indentation before the new {} block
-void IncreaseIndent() {
-  indent += "  ";
+    skip(size - 2 * edge);
+    if constexpr (std::ranges::bidirectional_range<const R> &&
+                  std::ranges::common_range<const R>) {
+      it = std::ranges::prev(std::ranges::end(x), edge);
+    } else {
+      std::ranges::advance(it, size - 2 * edge);
+    }
+    for (size_t i = size - edge; i < size; ++i, ++it) {
+      if (ctx.Exhausted(own_line)) {
+        return;
+      }
+      print(*it, i);
+    }
+  }
 }
 
-// Erase two spaces from indentation after the {} block
-void DecreaseIndent() {
-  indent.resize(indent.size() - 2);
-}
+// Print the range of scalars in one line: {1, 2, 3}
+// Contiguous arithmetic values are formatted in bulk
+template <class R>
+void PrintScalarSequence(Context &ctx, const R &x) {
+  if (ctx.TooDeep()) {
+    Writer::TooDeep(ctx);
+    return;
+  }
 
+  using T = std::ranges::range_value_t<R>;
+  if constexpr (std::ranges::sized_range<const R> && is_arithmetic<T>) {
+    // Make room for the text of the shown values at once, roughly
+    size_t size = std::ranges::size(x);
+    size_t bytes = std::min(size, 2 * ShownAtEachEnd(ctx, size)) *
+                   (Writer::kElementSeparator.size() + 2 * sizeof(T) + 1);
+    ctx.buffer.Reserve(ctx.limits.bytes != 0 ? std::min(bytes, ctx.limits.bytes)
+                                             : bytes);
+  }
+  if constexpr (std::ranges::contiguous_range<const R> && is_arithmetic<T> &&
+                Writer::kPlainArithmetic<T>) {
+    const T *values = std::ranges::data(x);
+    size_t size = std::ranges::size(x);
+    size_t edge = ShownAtEachEnd(ctx, size);
+    Writer::BeginRow(ctx);
+    if (PrintArithmeticValues(ctx, values, edge, true) && edge < size) {
+      Writer::RowSkipped(ctx, size - 2 * edge);
+      PrintArithmeticValues(ctx, values + size - edge, edge, false);
+    }
+    Writer::EndRow(ctx);
+    return;
+  }
 
-// Tries to print type name, without template parameter types.
-// On GCC and Clang user-defined class names turn out to be correct, thanks to
-// their extension abi::__cxa_demangle. On MSVC class names can be mangled a bit
-template <class T>
-void PrintTypeName(const T &x) {
-  const char *mangled = typeid(x).name();
+  Writer::BeginRow(ctx);
+  ForEachShown(
+      ctx, x, false,
+      [&ctx](const auto &elem, size_t i) {
+        Writer::RowElement(ctx, i);
+        PrettyPrint(ctx, elem);
+      },
+      [&ctx](size_t skipped) { Writer::RowSkipped(ctx, skipped); });
+  Writer::EndRow(ctx);
+}
 
-#ifdef DBG_DEMANGLE_CLASS_NAMES
-  int status = 0;
-  std::unique_ptr<char, void (*)(void *)> demangled{
-      abi::__cxa_demangle(mangled, nullptr, nullptr, &status), std::free};
-  const char *name = (status == 0) ? demangled.get() : mangled;
-#else
-  const char *name = mangled;
-#endif
-
-  for (int i = 0; name[i] != '\0'; ++i) {
-    if (name[i] == '<') {
-      std::string_view name_view(name, name + i);
-      // Make weird std names more readable
-      if (name_view == "std::__cxx11::basic_string") {
-        out << "std::string";
-      } else if (name_view == "std::__cxx11::list") {
-        out << "std::list";
-      } else {
-        out << name_view;
-      }
+// Print the range of class objects, each one on its own line after the index
+template <class R>
+void PrintClassSequence(Context &ctx, const R &x) {
+  if constexpr (std::ranges::forward_range<const R>) {
+    if (std::ranges::empty(x)) {
+      Writer::Empty(ctx);
       return;
     }
   }
-  out << name;
+  if (ctx.TooDeep()) {
+    Writer::TooDeep(ctx);
+    return;
+  }
+  Writer::BeginColumn(ctx, TypeName<std::ranges::range_value_t<R>>());
+  ForEachShown(
+      ctx, x, true,
+      [&ctx](const auto &elem, size_t i) {
+        DiffScope scope(ctx, i, Writer::kIndexedColumns);
+        Writer::BeginColumnElement(ctx, i);
+        PrettyPrint(ctx, elem);
+        Writer::EndColumnElement(ctx);
+      },
+      [&ctx](size_t skipped) { Writer::Skipped(ctx, skipped); });
+  Writer::EndColumn(ctx);
+}
+
+// Print the range of key-value pairs, each one on its own line after the key
+template <class R>
+void PrintMap(Context &ctx, const R &x) {
+  if (std::ranges::empty(x)) {
+    Writer::Empty(ctx);
+    return;
+  }
+  if (ctx.TooDeep()) {
+    Writer::TooDeep(ctx);
+    return;
+  }
+  Writer::BeginMap(ctx, TypeName<typename R::key_type>(),
+                   TypeName<typename R::mapped_type>());
+  ForEachShown(
+      ctx, x, true,
+      [&ctx](const auto &elem, size_t) {
+        DiffScope scope(ctx, 0);
+        Writer::BeginMapKey(ctx);
+        size_t key_begin = ctx.buffer.View().size();
+        PrettyPrint(ctx, elem.first);
+        scope.IdentifyByKey(key_begin);
+        Writer::BeginMapValue(ctx);
+        PrettyPrint(ctx, elem.second);
+        Writer::EndMapValue(ctx);
+      },
+      [&ctx](size_t skipped) { Writer::Skipped(ctx, skipped); });
+  Writer::EndMap(ctx);
 }
 
+// Dump the bytes in lines of offset, hex and chars. The limit of elements
+// counts the bytes
+inline void PrintBytes(Context &ctx, const unsigned char *bytes, size_t size) {
+  if (size != 0 && ctx.TooDeep()) {
+    Writer::TooDeep(ctx);
+    return;
+  }
+  size_t edge = ShownAtEachEnd(ctx, size);
+  Writer::BeginBytes(ctx, size);
+  if (Writer::HexBytes(ctx, bytes, 0, edge) && edge < size) {
+    Writer::BytesSkipped(ctx, size - 2 * edge);
+    Writer::HexBytes(ctx, bytes, size - edge, edge);
+  }
+  Writer::EndBytes(ctx, size);
+}
 
-// Prints current time in form of <dd.mm.yy HH:MM:SS>
-void PrintCurrTime() {
-  std::time_t timestamp = std::time(nullptr);
-  std::tm *now = std::localtime(&timestamp);
-  out << std::setfill('0') << std::setw(2) << now->tm_mday << "."
-      << std::setfill('0') << std::setw(2) << (now->tm_mon + 1) << "."
-      << std::setfill('0') << std::setw(2) << (now->tm_year % 100) << " "
-      << std::setfill('0') << std::setw(2) << now->tm_hour << ":"
-      << std::setfill('0') << std::setw(2) << now->tm_min << ":"
-      << std::setfill('0') << std::setw(2) << now->tm_sec;
+// The container std::queue, std::stack or std::priority_queue keeps its
+// elements in, so they are read in place instead of popping a copy
+template <class A>
+const typename A::container_type &UnderlyingContainer(const A &x) {
+  // The adaptors expose the container to the derived classes only
+  struct Access : A {
+    static const typename A::container_type &Get(const A &x) {
+      return x.*&Access::c;
+    }
+  };
+  return Access::Get(x);
 }
 
 
-// Print scalar type like int, float or char
+// Print scalar type like int, float or char. Arithmetic ones are formatted
+// without the stream
 template <class T>
   requires is_scalar<T>
-void PrettyPrint(T x) {
-  out << x;
+void PrettyPrint(Context &ctx, T x) {
+  Writer::Scalar(ctx, x);
 }
 
 // Print any class object, that isn't overloaded later
 // Note that class must generate PrettyPrint method using DERIVE_DEBUG macro
 template <class T>
   requires is_class<T>
-void PrettyPrint(const T &x) {
-  const_cast<T &>(x).PrettyPrint();
+void PrettyPrint(Context &ctx, const T &x) {
+  if (ctx.TooDeep()) {
+    Writer::TooDeep(ctx);
+    return;
+  }
+  const_cast<T &>(x).PrettyPrint(ctx);
 }
 
 
 // Print what's behind std::ref
 template <class T>
-void PrettyPrint(std::reference_wrapper<T> x) {
-  PrettyPrint(x.get());
+void PrettyPrint(Context &ctx, std::reference_wrapper<T> x) {
+  PrettyPrint(ctx, x.get());
 }
 
 
 // Print std::pair of two scalars
 template <class F, class S>
   requires is_scalar<F> && is_scalar<S>
-void PrettyPrint(const std::pair<F, S> &x) {
-  out << "{" << x.first << ", " << x.second << "}";
+void PrettyPrint(Context &ctx, const std::pair<F, S> &x) {
+  Writer::BeginRow(ctx);
+  Writer::RowElement(ctx, 0);
+  PrettyPrint(ctx, x.first);
+  Writer::RowElement(ctx, 1);
+  PrettyPrint(ctx, x.second);
+  Writer::EndRow(ctx);
 }
 
 // Print std::pair where at least one element is class object
 template <class F, class S>
   requires is_class<F> || is_class<S>
-void PrettyPrint(const std::pair<F, S> &x) {
-  out << "{\n";
-  IncreaseIndent();
-  out << indent << "first: ";
-  PrintTypeName(x.first);
-  out << " = ";
-  PrettyPrint(x.first);
-  out << "\n" << indent << "second: ";
-  PrintTypeName(x.second);
-  out << " = ";
-  PrettyPrint(x.second);
-  DecreaseIndent();
-  out << "\n" << indent << "}";
+void PrettyPrint(Context &ctx, const std::pair<F, S> &x) {
+  if (ctx.TooDeep()) {
+    Writer::TooDeep(ctx);
+    return;
+  }
+  Writer::BeginObject(ctx);
+  Writer::BeginField(ctx, "first", TypeName<F>());
+  PrettyPrint(ctx, x.first);
+  Writer::EndField(ctx);
+  Writer::BeginField(ctx, "second", TypeName<S>());
+  PrettyPrint(ctx, x.second);
+  Writer::EndField(ctx);
+  Writer::EndObject(ctx);
 }
 
 
 // Print std::string
-void PrettyPrint(const std::string &x) {
-  out << "\"" << x << "\"";
+inline void PrettyPrint(Context &ctx, const std::string &x) {
+  Writer::String(ctx, x);
 }
 
 // Print std::string_view
-void PrettyPrint(const std::string_view &x) {
-  out << "\"" << x << "\"";
+inline void PrettyPrint(Context &ctx, const std::string_view &x) {
+  Writer::String(ctx, x);
 }
 
+#if defined(DBG_DEFINE_CORE)
 // Print std::stringstream contents
-void PrettyPrint(const std::stringstream &x) {
-  out << "\"" << x.str() << "\"";
+DBG_INLINE void PrettyPrint(Context &ctx, const std::stringstream &x) {
+  Writer::String(ctx, x.view());
 }
+#endif
 
 
-// Print std::array of scalars
-template <class T, size_t N>
-  requires is_scalar<T>
-void PrettyPrint(const std::array<T, N> &x) {
-  out << "{";
-  if (!x.empty()) {
-    PrettyPrint(x[0]);
-  }
-  for (int i = 1; i < x.size(); ++i) {
-    out << ", ";
-    PrettyPrint(x[i]);
+// Print any range of scalars in one line and any range of class objects each
+// one on its own line after the index. The views that are iterated only while
+// mutable, e.g. std::views::filter caching its begin, are iterated as such
+template <class R>
+  requires is_sequence<R>
+void PrettyPrint(Context &ctx, const R &x) {
+  if constexpr (!std::ranges::input_range<const R>) {
+    PrettyPrint(ctx, MutableView<R>{&const_cast<R &>(x)});
+  } else if constexpr (is_byte_range<R>) {
+    PrintBytes(ctx,
+               reinterpret_cast<const unsigned char *>(std::ranges::data(x)),
+               std::ranges::size(x));
+  } else if constexpr (is_scalar<std::ranges::range_value_t<const R>>) {
+    PrintScalarSequence(ctx, x);
+  } else {
+    PrintClassSequence(ctx, x);
   }
-  out << "}";
 }
 
-// Print std::array of class objects
-template <class T, size_t N>
-  requires is_class<T>
-void PrettyPrint(const std::array<T, N> &x) {
-  if (x.empty()) {
-    out << "{}";
-    return;
-  }
-  out << "{\n";
-  IncreaseIndent();
-  out << indent << "<";
-  PrintTypeName(x[0]);
-  out << ">\n";
-  for (int i = 0; i < x.size(); ++i) {
-    out << indent << "[" << i << "] = ";
-    PrettyPrint(x[i]);
-    out << "\n";
-  }
-  DecreaseIndent();
-  out << indent << "}";
+// Print any range of key-value pairs, regardless keys and values are scalars
+// or class objects
+template <class R>
+  requires is_map<R>
+void PrettyPrint(Context &ctx, const R &x) {
+  PrintMap(ctx, x);
 }
 
 
-// Print std::vector of scalars
+// Print the argument of dbg_hex() as the dump of its bytes
 template <class T>
-  requires is_scalar<T>
-void PrettyPrint(const std::vector<T> &x) {
-  out << "{";
-  if (!x.empty()) {
-    PrettyPrint(x[0]);
+void PrettyPrint(Context &ctx, const HexDump<T> &x) {
+  if constexpr (std::ranges::contiguous_range<const T> &&
+                std::ranges::sized_range<const T>) {
+    using Value = std::ranges::range_value_t<const T>;
+    static_assert(std::is_trivially_copyable_v<Value>,
+                  "dbg_hex() dumps the ranges of trivially copyable values");
+    PrintBytes(ctx,
+               reinterpret_cast<const unsigned char *>(std::ranges::data(x.x)),
+               std::ranges::size(x.x) * sizeof(Value));
+  } else {
+    static_assert(std::is_trivially_copyable_v<T>,
+                  "dbg_hex() dumps the contiguous ranges and the trivially "
+                  "copyable objects");
+    PrintBytes(ctx,
+               reinterpret_cast<const unsigned char *>(std::addressof(x.x)),
+               sizeof(T));
   }
-  for (int i = 1; i < x.size(); ++i) {
-    out << ", ";
-    PrettyPrint(x[i]);
+}
+
+
+// Merge min, max and sum of the other part of the range
+template <class E>
+void NumberStats<E>::AddMoments(const NumberStats &other) {
+  count += other.count;
+  nan += other.nan;
+  inf += other.inf;
+  finite += other.finite;
+  min = std::min(min, other.min);
+  max = std::max(max, other.max);
+  sum += other.sum;
+}
+
+// Merge squares and the histogram of the other part of the range
+template <class E>
+void NumberStats<E>::AddSpread(const NumberStats &other) {
+  squares += other.squares;
+  for (size_t i = 0; i < kStatsBuckets; ++i) {
+    histogram[i] += other.histogram[i];
   }
-  out << "}";
 }
 
-// Print std::vector of class objects
-template <class T>
-  requires is_class<T>
-void PrettyPrint(const std::vector<T> &x) {
-  if (x.empty()) {
-    out << "{}";
-    return;
+// Count the values and take min, max and sum of the finite ones. The random
+// access ranges are read into 4 lanes, so the operations of one lane don't
+// wait for the ones of the others
+template <class E, class It>
+NumberStats<E> SummarizeMoments(It first, It last) {
+  constexpr size_t kLanes = std::random_access_iterator<It> ? 4 : 1;
+  std::array<E, kLanes> mins;
+  std::array<E, kLanes> maxs;
+  mins.fill(std::numeric_limits<E>::max());
+  maxs.fill(std::numeric_limits<E>::lowest());
+  std::array<double, kLanes> sums{};
+  std::array<uint64_t, kLanes> nans{};
+  std::array<uint64_t, kLanes> infs{};
+  auto add = [&](size_t lane, E v) {
+    if constexpr (std::is_floating_point_v<E>) {
+      bool nan = v != v;
+      bool inf = std::abs(v) == std::numeric_limits<E>::infinity();
+      bool finite = !nan && !inf;
+      nans[lane] += nan;
+      infs[lane] += inf;
+      sums[lane] += finite ? static_cast<double>(v) : 0;
+      mins[lane] = finite && v < mins[lane] ? v : mins[lane];
+      maxs[lane] = finite && v > maxs[lane] ? v : maxs[lane];
+    } else {
+      sums[lane] += static_cast<double>(v);
+      mins[lane] = std::min(mins[lane], v);
+      maxs[lane] = std::max(maxs[lane], v);
+    }
+  };
+
+  uint64_t count = 0;
+  if constexpr (kLanes > 1) {
+    size_t size = last - first;
+    size_t i = 0;
+    for (; i + 4 <= size; i += 4) {
+      add(0, first[i]);
+      add(1, first[i + 1]);
+      add(2, first[i + 2]);
+      add(3, first[i + 3]);
+    }
+    for (; i < size; ++i) {
+      add(0, first[i]);
+    }
+    count = size;
+  } else {
+    for (; first != last; ++first, ++count) {
+      add(0, *first);
+    }
   }
-  out << "{\n";
-  IncreaseIndent();
-  out << indent << "<";
-  PrintTypeName(x[0]);
-  out << ">\n";
-  for (int i = 0; i < x.size(); ++i) {
-    out << indent << "[" << i << "] = ";
-    PrettyPrint(x[i]);
-    out << "\n";
+
+  NumberStats<E> stats;
+  stats.count = count;
+  for (size_t lane = 0; lane < kLanes; ++lane) {
+    stats.nan += nans[lane];
+    stats.inf += infs[lane];
+    stats.min = std::min(stats.min, mins[lane]);
+    stats.max = std::max(stats.max, maxs[lane]);
+    stats.sum += sums[lane];
   }
-  DecreaseIndent();
-  out << indent << "}";
+  stats.finite = count - stats.nan - stats.inf;
+  return stats;
 }
 
-
-// Print std::deque of scalars
-template <class T>
-  requires is_scalar<T>
-void PrettyPrint(const std::deque<T> &x) {
-  out << "{";
-  if (!x.empty()) {
-    PrettyPrint(x[0]);
+#if defined(__SSE2__)
+// SummarizeMoments() of the contiguous floating point values, two doubles per
+// instruction in two independent sets of them. The floats are widened first,
+// that's exact
+template <class E>
+NumberStats<E> SummarizeFloatMoments(const E *first, const E *last) {
+  const __m128d abs_mask = _mm_castsi128_pd(_mm_set1_epi64x(INT64_MAX));
+  const __m128d inf = _mm_set1_pd(std::numeric_limits<double>::infinity());
+  const __m128d highest = _mm_set1_pd(std::numeric_limits<double>::max());
+  const __m128d lowest = _mm_set1_pd(std::numeric_limits<double>::lowest());
+  struct Lanes {
+    __m128d sum;
+    __m128d min;
+    __m128d max;
+    // Less 1 per NaN and infinity
+    __m128i nans;
+    __m128i infs;
+  };
+  Lanes a = {_mm_setzero_pd(), highest, lowest, _mm_setzero_si128(),
+             _mm_setzero_si128()};
+  Lanes b = a;
+  auto add = [&](Lanes &lanes, __m128d x) {
+    __m128d abs = _mm_and_pd(x, abs_mask);
+    __m128d finite = _mm_cmplt_pd(abs, inf);
+    lanes.nans = _mm_add_epi64(lanes.nans,
+                               _mm_castpd_si128(_mm_cmpunord_pd(x, x)));
+    lanes.infs = _mm_add_epi64(lanes.infs,
+                               _mm_castpd_si128(_mm_cmpeq_pd(abs, inf)));
+    __m128d kept = _mm_and_pd(x, finite);
+    lanes.sum = _mm_add_pd(lanes.sum, kept);
+    lanes.min = _mm_min_pd(lanes.min,
+                           _mm_or_pd(kept, _mm_andnot_pd(finite, highest)));
+    lanes.max = _mm_max_pd(lanes.max,
+                           _mm_or_pd(kept, _mm_andnot_pd(finite, lowest)));
+  };
+
+  size_t size = last - first;
+  size_t i = 0;
+  for (; i + 4 <= size; i += 4) {
+    if constexpr (std::same_as<E, float>) {
+      __m128 x = _mm_loadu_ps(first + i);
+      add(a, _mm_cvtps_pd(x));
+      add(b, _mm_cvtps_pd(_mm_movehl_ps(x, x)));
+    } else {
+      add(a, _mm_loadu_pd(first + i));
+      add(b, _mm_loadu_pd(first + i + 2));
+    }
   }
-  for (int i = 1; i < x.size(); ++i) {
-    out << ", ";
-    PrettyPrint(x[i]);
+
+  NumberStats<E> stats = SummarizeMoments<E>(first + i, last);
+  std::array<double, 2> sums;
+  std::array<double, 2> mins;
+  std::array<double, 2> maxs;
+  std::array<int64_t, 2> nans;
+  std::array<int64_t, 2> infs;
+  _mm_storeu_pd(sums.data(), _mm_add_pd(a.sum, b.sum));
+  _mm_storeu_pd(mins.data(), _mm_min_pd(a.min, b.min));
+  _mm_storeu_pd(maxs.data(), _mm_max_pd(a.max, b.max));
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(nans.data()),
+                   _mm_add_epi64(a.nans, b.nans));
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(infs.data()),
+                   _mm_add_epi64(a.infs, b.infs));
+  NumberStats<E> vectors;
+  vectors.count = i;
+  vectors.nan = -(nans[0] + nans[1]);
+  vectors.inf = -(infs[0] + infs[1]);
+  vectors.finite = vectors.count - vectors.nan - vectors.inf;
+  vectors.min = static_cast<E>(std::min(mins[0], mins[1]));
+  vectors.max = static_cast<E>(std::max(maxs[0], maxs[1]));
+  vectors.sum = sums[0] + sums[1];
+  stats.AddMoments(vectors);
+  return stats;
+}
+#endif
+
+// SummarizeMoments() of the contiguous values, with the vector instructions
+// for the floating point ones where they are
+template <class E>
+NumberStats<E> SummarizeContiguousMoments(const E *first, const E *last) {
+#if defined(__SSE2__)
+  if constexpr (std::same_as<E, float> || std::same_as<E, double>) {
+    return SummarizeFloatMoments(first, last);
   }
-  out << "}";
+#endif
+  return SummarizeMoments<E>(first, last);
 }
 
-// Print std::deque of class objects
-template <class T>
-  requires is_class<T>
-void PrettyPrint(const std::deque<T> &x) {
-  if (x.empty()) {
-    out << "{}";
-    return;
+// Take squares of the deviations of the finite values from the mean and count
+// them into the histogram between min and max of the whole range. Consecutive
+// values tend to fall into the same bucket, so the random access ranges are
+// counted into 4 histograms whose increments don't wait for each other
+template <class E, class It>
+NumberStats<E> SummarizeSpread(It first, It last, const NumberStats<E> &whole) {
+  constexpr size_t kLanes = std::random_access_iterator<It> ? 4 : 1;
+  double mean = whole.Mean();
+  double min = static_cast<double>(whole.min);
+  double range = static_cast<double>(whole.max) - min;
+  double scale = range > 0 ? kStatsBuckets / range : 0;
+  std::array<std::array<uint64_t, kStatsBuckets>, kLanes> histograms{};
+  std::array<double, kLanes> squares{};
+  auto add = [&](size_t lane, E v) {
+    if constexpr (std::is_floating_point_v<E>) {
+      if (!(std::abs(v) <= std::numeric_limits<E>::max())) [[unlikely]] {
+        return;
+      }
+    }
+    double x = static_cast<double>(v);
+    squares[lane] += (x - mean) * (x - mean);
+    size_t bucket = static_cast<size_t>((x - min) * scale);
+    ++histograms[lane][bucket < kStatsBuckets ? bucket : kStatsBuckets - 1];
+  };
+
+  if constexpr (kLanes > 1) {
+    size_t size = last - first;
+    size_t i = 0;
+    for (; i + 4 <= size; i += 4) {
+      add(0, first[i]);
+      add(1, first[i + 1]);
+      add(2, first[i + 2]);
+      add(3, first[i + 3]);
+    }
+    for (; i < size; ++i) {
+      add(0, first[i]);
+    }
+  } else {
+    for (; first != last; ++first) {
+      add(0, *first);
+    }
   }
-  out << "{\n";
-  IncreaseIndent();
-  out << indent << "<";
-  PrintTypeName(x[0]);
-  out << ">\n";
-  for (int i = 0; i < x.size(); ++i) {
-    out << indent << "[" << i << "] = ";
-    PrettyPrint(x[i]);
-    out << "\n";
+
+  NumberStats<E> stats;
+  for (size_t lane = 0; lane < kLanes; ++lane) {
+    stats.squares += squares[lane];
+    for (size_t i = 0; i < kStatsBuckets; ++i) {
+      stats.histogram[i] += histograms[lane][i];
+    }
   }
-  DecreaseIndent();
-  out << indent << "}";
+  return stats;
 }
 
-
-// Print std::queue of scalars
-template <class T>
-  requires is_scalar<T>
-void PrettyPrint(std::queue<T> x) {
-  out << "{";
-  if (!x.empty()) {
-    PrettyPrint(x.front());
-    x.pop();
+// Summarize the range of numbers in two passes: the moments and then the
+// spread around the mean. The huge contiguous ones are split into chunks
+// summarized on all cores with DBG_PARALLEL_STATS
+template <class R>
+auto SummarizeNumbers(const R &x) {
+  using E = std::ranges::range_value_t<const R>;
+  NumberStats<E> stats;
+#if defined(DBG_PARALLEL_STATS)
+  if constexpr (std::ranges::contiguous_range<const R> &&
+                std::ranges::sized_range<const R>) {
+    const E *data = std::ranges::data(x);
+    size_t size = std::ranges::size(x);
+    if (size >= kParallelStatsSize) {
+      std::array<NumberStats<E>, kParallelStatsChunks> parts;
+      auto chunk = [&](const NumberStats<E> &part) {
+        size_t i = &part - parts.data();
+        return std::pair(data + size * i / parts.size(),
+                         data + size * (i + 1) / parts.size());
+      };
+      std::for_each(std::execution::par_unseq, parts.begin(), parts.end(),
+                    [&](NumberStats<E> &part) {
+                      auto [first, last] = chunk(part);
+                      part = SummarizeContiguousMoments(first, last);
+                    });
+      for (const NumberStats<E> &part : parts) {
+        stats.AddMoments(part);
+      }
+      std::for_each(std::execution::par_unseq, parts.begin(), parts.end(),
+                    [&](NumberStats<E> &part) {
+                      auto [first, last] = chunk(part);
+                      part = SummarizeSpread<E>(first, last, stats);
+                    });
+      for (const NumberStats<E> &part : parts) {
+        stats.AddSpread(part);
+      }
+      return stats;
+    }
   }
-  while (!x.empty()) {
-    out << ", ";
-    PrettyPrint(x.front());
-    x.pop();
+#endif
+  if constexpr (std::ranges::contiguous_range<const R> &&
+                std::ranges::sized_range<const R>) {
+    const E *data = std::ranges::data(x);
+    const E *end = data + std::ranges::size(x);
+    stats.AddMoments(SummarizeContiguousMoments(data, end));
+    stats.AddSpread(SummarizeSpread<E>(data, end, stats));
+  } else {
+    stats.AddMoments(SummarizeMoments<E>(std::ranges::begin(x),
+                                         std::ranges::end(x)));
+    stats.AddSpread(SummarizeSpread<E>(std::ranges::begin(x),
+                                       std::ranges::end(x), stats));
   }
-  out << "}";
+  return stats;
 }
 
-// Print std::queue of class objects
+// Print the argument of dbg_stats() as the summary of its numbers. Min and max
+// are of the element type, the integers are widened so they print as numbers.
+// Stddev is the one of the whole population
 template <class T>
-  requires is_class<T> && std::is_copy_constructible_v<T>
-void PrettyPrint(std::queue<T> x) {
-  if (x.empty()) {
-    out << "{}";
-    return;
-  }
-  out << "{\n";
-  IncreaseIndent();
-  out << indent << "<";
-  PrintTypeName(x.front());
-  out << ">\n";
-  for (int i = 0; !x.empty(); ++i) {
-    out << indent << "[" << i << "] = ";
-    PrettyPrint(x.front());
-    x.pop();
-    out << "\n";
+void PrettyPrint(Context &ctx, const Stats<T> &x) {
+  static_assert(std::ranges::forward_range<const T>,
+                "dbg_stats() summarizes the ranges that may be iterated twice");
+  using E = std::ranges::range_value_t<const T>;
+  static_assert(std::is_arithmetic_v<E> && !std::same_as<E, bool>,
+                "dbg_stats() summarizes the ranges of numbers");
+  using Extreme = std::conditional_t<
+      std::is_floating_point_v<E>, E,
+      std::conditional_t<std::is_signed_v<E>, int64_t, uint64_t>>;
+
+  NumberStats<E> stats = SummarizeNumbers(x.x);
+  Writer::BeginObject(ctx);
+  if (stats.finite == 0) {
+    if constexpr (std::is_floating_point_v<E>) {
+      MultiplexPrettyPrintOnVaArgs(
+          ctx, std::array<std::string_view, 3>{"count", "nan", "inf"},
+          stats.count, stats.nan, stats.inf);
+    } else {
+      MultiplexPrettyPrintOnVaArgs(
+          ctx, std::array<std::string_view, 1>{"count"}, stats.count);
+    }
+  } else {
+    Extreme min = stats.min;
+    Extreme max = stats.max;
+    double mean = stats.Mean();
+    double stddev =
+        std::sqrt(stats.squares / static_cast<double>(stats.finite));
+    if constexpr (std::is_floating_point_v<E>) {
+      MultiplexPrettyPrintOnVaArgs(
+          ctx,
+          std::array<std::string_view, 8>{"count", "min", "max", "mean",
+                                          "stddev", "nan", "inf",
+                                          "histogram"},
+          stats.count, min, max, mean, stddev, stats.nan, stats.inf,
+          stats.histogram);
+    } else {
+      MultiplexPrettyPrintOnVaArgs(
+          ctx,
+          std::array<std::string_view, 6>{"count", "min", "max", "mean",
+                                          "stddev", "histogram"},
+          stats.count, min, max, mean, stddev, stats.histogram);
+    }
   }
-  DecreaseIndent();
-  out << indent << "}";
+  Writer::EndObject(ctx);
 }
 
 
-// Print std::stack of scalars
-template <class T>
+// Print std::queue of scalars from front to back
+template <class T, class C>
   requires is_scalar<T>
-void PrettyPrint(std::stack<T> x) {
-  out << "{";
-  if (!x.empty()) {
-    PrettyPrint(x.top());
-    x.pop();
-  }
-  while (!x.empty()) {
-    out << ", ";
-    PrettyPrint(x.top());
-    x.pop();
-  }
-  out << "}";
+void PrettyPrint(Context &ctx, const std::queue<T, C> &x) {
+  PrintScalarSequence(ctx, UnderlyingContainer(x));
 }
 
-// Print std::stack of class objects
-template <class T>
-  requires is_class<T> && std::is_copy_constructible_v<T>
-void PrettyPrint(std::stack<T> x) {
-  if (x.empty()) {
-    out << "{}";
-    return;
-  }
-  out << "{\n";
-  IncreaseIndent();
-  out << indent << "<";
-  PrintTypeName(x.top());
-  out << ">\n";
-  for (int i = 0; !x.empty(); ++i) {
-    out << indent << "[" << i << "] = ";
-    PrettyPrint(x.top());
-    x.pop();
-    out << "\n";
-  }
-  DecreaseIndent();
-  out << indent << "}";
+// Print std::queue of class objects from front to back
+template <class T, class C>
+  requires is_class<T>
+void PrettyPrint(Context &ctx, const std::queue<T, C> &x) {
+  PrintClassSequence(ctx, UnderlyingContainer(x));
 }
 
 
-// Print std::list of scalars
-template <class T>
+// Print std::stack of scalars from top to bottom
+template <class T, class C>
   requires is_scalar<T>
-void PrettyPrint(const std::list<T> &x) {
-  out << "{";
-  auto it = x.begin(), end = x.end();
-  if (!x.empty()) {
-    PrettyPrint(*it);
-    ++it;
-  }
-  for (; it != end; ++it) {
-    out << ", ";
-    PrettyPrint(*it);
-  }
-  out << "}";
+void PrettyPrint(Context &ctx, const std::stack<T, C> &x) {
+  PrintScalarSequence(ctx, std::views::reverse(UnderlyingContainer(x)));
 }
 
-// Print std::list of class objects
-template <class T>
+// Print std::stack of class objects from top to bottom
+template <class T, class C>
   requires is_class<T>
-void PrettyPrint(const std::list<T> &x) {
-  if (x.empty()) {
-    out << "{}";
-    return;
-  }
-  out << "{\n";
-  auto it = x.begin(), end = x.end();
-  IncreaseIndent();
-  out << indent << "<";
-  PrintTypeName(*it);
-  out << ">\n";
-  for (int i = 0; it != end; ++i, ++it) {
-    out << indent << "[" << i << "] = ";
-    PrettyPrint(*it);
-    out << "\n";
-  }
-  DecreaseIndent();
-  out << indent << "}";
+void PrettyPrint(Context &ctx, const std::stack<T, C> &x) {
+  PrintClassSequence(ctx, std::views::reverse(UnderlyingContainer(x)));
 }
 
 
-// Print std::set of scalars
-template <class T>
+// Print std::priority_queue of scalars in the heap order, top first
+template <class T, class C, class Compare>
   requires is_scalar<T>
-void PrettyPrint(const std::set<T> &x) {
-  out << "{";
-  auto it = x.begin(), end = x.end();
-  if (!x.empty()) {
-    PrettyPrint(*it);
-    ++it;
-  }
-  for (; it != end; ++it) {
-    out << ", ";
-    PrettyPrint(*it);
-  }
-  out << "}";
+void PrettyPrint(Context &ctx, const std::priority_queue<T, C, Compare> &x) {
+  PrintScalarSequence(ctx, UnderlyingContainer(x));
 }
 
-// Print std::set of class objects
-template <class T>
+// Print std::priority_queue of class objects in the heap order, top first
+template <class T, class C, class Compare>
   requires is_class<T>
-void PrettyPrint(const std::set<T> &x) {
-  if (x.empty()) {
-    out << "{}";
-    return;
-  }
-  out << "{\n";
-  auto it = x.begin(), end = x.end();
-  IncreaseIndent();
-  out << indent << "<";
-  PrintTypeName(*it);
-  out << ">\n";
-  for (int i = 0; it != end; ++i, ++it) {
-    out << indent << "[" << i << "] = ";
-    PrettyPrint(*it);
-    out << "\n";
-  }
-  DecreaseIndent();
-  out << indent << "}";
+void PrettyPrint(Context &ctx, const std::priority_queue<T, C, Compare> &x) {
+  PrintClassSequence(ctx, UnderlyingContainer(x));
 }
 
 
-// Print std::unordered_set of scalars
+// Print unique pointer to scalar
 template <class T>
   requires is_scalar<T>
-void PrettyPrint(const std::unordered_set<T> &x) {
-  out << "{";
-  auto it = x.begin(), end = x.end();
-  if (!x.empty()) {
-    PrettyPrint(*it);
-    ++it;
-  }
-  for (; it != end; ++it) {
-    out << ", ";
-    PrettyPrint(*it);
+void PrettyPrint(Context &ctx, const std::unique_ptr<T> &x) {
+  if (x == nullptr) {
+    Writer::Null(ctx);
+    return;
   }
-  out << "}";
+  Writer::BeginPointee(ctx);
+  PrettyPrint(ctx, *x);
+  Writer::EndPointee(ctx);
 }
 
-// Print std::unordered_set of class objects
+// Print unique pointer to class
 template <class T>
   requires is_class<T>
-void PrettyPrint(const std::unordered_set<T> &x) {
-  if (x.empty()) {
-    out << "{}";
+void PrettyPrint(Context &ctx, const std::unique_ptr<T> &x) {
+  if (x == nullptr) {
+    Writer::Null(ctx);
     return;
   }
-  out << "{\n";
-  auto it = x.begin(), end = x.end();
-  IncreaseIndent();
-  out << indent << "<";
-  PrintTypeName(*it);
-  out << ">\n";
-  for (int i = 0; it != end; ++i, ++it) {
-    PrettyPrint(*it);
-    out << "\n";
+  if (ctx.TooDeep()) {
+    Writer::TooDeep(ctx);
+    return;
   }
-  DecreaseIndent();
-  out << indent << "}";
+  Writer::BeginClassPointee(ctx, " -> ", TypeName<T>(), nullptr);
+  PrettyPrint(ctx, *x);
+  Writer::EndClassPointee(ctx);
 }
 
 
-// Print std::map regargdell keys and values are scalars or class objects
-template <class K, class V>
-void PrettyPrint(const std::map<K, V> &x) {
-  if (x.empty()) {
-    out << "{}";
+// Print shared pointer to scalar
+template <class T>
+  requires is_scalar<T>
+void PrettyPrint(Context &ctx, const std::shared_ptr<T> &x) {
+  if (x == nullptr) {
+    Writer::Null(ctx);
     return;
   }
-  out << "{\n";
-  auto it = x.begin(), end = x.end();
-  IncreaseIndent();
-  out << indent << "<";
-  PrintTypeName(it->first);
-  out << " -> ";
-  PrintTypeName(it->second);
-  out << ">\n";
-  for (; it != end; ++it) {
-    out << indent << "[";
-    PrettyPrint(it->first);
-    out << "] = ";
-    PrettyPrint(it->second);
-    out << "\n";
-  }
-  DecreaseIndent();
-  out << indent << "}";
+  Writer::BeginPointee(ctx);
+  PrettyPrint(ctx, *x);
+  Writer::EndPointee(ctx);
 }
 
-
-// Print std::unordered_map regargdell keys and values are scalars or classes
-template <class K, class V>
-void PrettyPrint(const std::unordered_map<K, V> &x) {
-  if (x.empty()) {
-    out << "{}";
+// Print shared pointer to class. The object is printed once per record, the
+// pointers it's seen behind again as the same type, e.g. the shared children
+// of a DAG or the ones closing a cycle, refer to its address. An alias to its
+// first member is a different object at the same address
+template <class T>
+  requires is_class<T>
+void PrettyPrint(Context &ctx, const std::shared_ptr<T> &x) {
+  if (x == nullptr) {
+    Writer::Null(ctx);
     return;
   }
-  out << "{\n";
-  auto it = x.begin(), end = x.end();
-  IncreaseIndent();
-  out << indent << "<";
-  PrintTypeName(it->first);
-  out << " -> ";
-  PrintTypeName(it->second);
-  out << ">\n";
-  for (; it != end; ++it) {
-    out << indent << "[";
-    PrettyPrint(it->first);
-    out << "] = ";
-    PrettyPrint(it->second);
-    out << "\n";
+  if (ctx.TooDeep()) {
+    Writer::TooDeep(ctx);
+    return;
+  }
+  const void *address = x.get();
+  if (!ctx.pointees.Insert(address, &kTypeTag<std::remove_cv_t<T>>)) {
+    Writer::SeenPointee(ctx, address);
+    return;
   }
-  DecreaseIndent();
-  out << indent << "}";
+  Writer::BeginClassPointee(ctx, "", TypeName<T>(), address);
+  PrettyPrint(ctx, *x);
+  Writer::EndClassPointee(ctx);
 }
 
 
-// Print unique pointer to scalar
-template <class T>
-  requires is_scalar<T>
-void PrettyPrint(const std::unique_ptr<T> &x) {
-  out << "{";
-  PrettyPrint(*x);
-  out << "}";
-}
+// Defined after all the other globals, so it's destroyed before them. It's
+// defined by the core only, as the sink and the writer are
+#if defined(DBG_DEFINE_CORE)
+inline SummariesAtExit summaries_at_exit;
+#endif
 
-// Print unique pointer to class
-template <class T>
-  requires is_class<T>
-void PrettyPrint(const std::unique_ptr<T> &x) {
-  IncreaseIndent();
-  out << "{\n" << indent << "< -> ";
-  PrintTypeName(*x);
-  out << ">\n" << indent;
-  PrettyPrint(*x);
-  DecreaseIndent();
-  out << "\n" << indent << "}";
-}
 
+// The common instantiations, with DBG_SEPARATE_CORE they're compiled once into
+// dbg.cc and the other translation units only call them
+#if defined(DBG_SEPARATE_CORE)
+#if defined(DBG_IMPLEMENTATION)
+#define DBG_INSTANTIATE template
+#else
+#define DBG_INSTANTIATE extern template
+#endif
+DBG_INSTANTIATE void PrettyPrint(Context &ctx, bool x);
+DBG_INSTANTIATE void PrettyPrint(Context &ctx, char x);
+DBG_INSTANTIATE void PrettyPrint(Context &ctx, int x);
+DBG_INSTANTIATE void PrettyPrint(Context &ctx, unsigned x);
+DBG_INSTANTIATE void PrettyPrint(Context &ctx, long x);
+DBG_INSTANTIATE void PrettyPrint(Context &ctx, unsigned long x);
+DBG_INSTANTIATE void PrettyPrint(Context &ctx, float x);
+DBG_INSTANTIATE void PrettyPrint(Context &ctx, double x);
+DBG_INSTANTIATE void PrettyPrint(Context &ctx, const std::vector<int> &x);
+DBG_INSTANTIATE void PrettyPrint(Context &ctx, const std::vector<long> &x);
+DBG_INSTANTIATE void PrettyPrint(Context &ctx,
+                                 const std::vector<unsigned long> &x);
+DBG_INSTANTIATE void PrettyPrint(Context &ctx, const std::vector<float> &x);
+DBG_INSTANTIATE void PrettyPrint(Context &ctx, const std::vector<double> &x);
+DBG_INSTANTIATE void PrettyPrint(Context &ctx,
+                                 const std::vector<std::string> &x);
+DBG_INSTANTIATE void PrettyPrint(Context &ctx, const std::set<int> &x);
+DBG_INSTANTIATE void PrettyPrint(Context &ctx, const std::set<std::string> &x);
+DBG_INSTANTIATE void PrettyPrint(Context &ctx, const std::map<int, int> &x);
+DBG_INSTANTIATE void PrettyPrint(Context &ctx,
+                                 const std::map<std::string, int> &x);
+DBG_INSTANTIATE void PrettyPrint(Context &ctx,
+                                 const std::map<std::string, double> &x);
+DBG_INSTANTIATE void PrettyPrint(Context &ctx,
+                                 const std::map<std::string, std::string> &x);
+DBG_INSTANTIATE void PrettyPrint(
+    Context &ctx, const std::unordered_map<std::string, int> &x);
+DBG_INSTANTIATE void PrettyPrint(
+    Context &ctx, const std::unordered_map<std::string, std::string> &x);
+#undef DBG_INSTANTIATE
+#endif
 
-// Print shared pointer to scalar
-template <class T>
-  requires is_scalar<T>
-void PrettyPrint(const std::shared_ptr<T> &x) {
-  out << "{";
-  PrettyPrint(*x);
-  out << "}";
-}
+}  // namespace __dbg_internal
 
-// Print shared pointer to class
-template <class T>
-  requires is_class<T>
-void PrettyPrint(const std::shared_ptr<T> &x) {
-  IncreaseIndent();
-  out << "{\n" << indent << "<";
-  PrintTypeName(*x);
-  out << ">\n" << indent;
-  PrettyPrint(*x);
-  DecreaseIndent();
-  out << "\n" << indent << "}";
-}
+#undef DBG_DEFINE_CORE
+#undef DBG_INLINE
 
-}  // namespace __dbg_internal
+#endif  // DBG_COMPILE_OUT
@@ -0,0 +1,59 @@
+# Run the test program in its own empty directory and compare the file it
+# writes with the expected text. It's called by ctest as
+#
+#   cmake -DPROGRAM=<path> -DDIRECTORY=<dir> -DOUTPUT=<file>
+#         -DEXPECTED=<file> -DSOURCE_DIR=<dir> [-DTOOL=<path>]
+#         [-DTOOL_ARGS=<args>] [-DNUMBERS_AFTER=<regexes>] -P check_output.cmake
+#
+# With TOOL the output is what the tool writes to stdout given TOOL_ARGS, run
+# after the program in the same directory. Before comparing, the output has
+# the directory of the sources cut from the paths, the times replaced by
+# <time>, the addresses by <address N> in the order they appear, and the
+# numbers after each of NUMBERS_AFTER, the ones that vary from run to run,
+# by <n>
+
+# The lists come separated by | rather than ;
+string(REPLACE "|" ";" TOOL_ARGS "${TOOL_ARGS}")
+string(REPLACE "|" ";" NUMBERS_AFTER "${NUMBERS_AFTER}")
+
+file(REMOVE_RECURSE ${DIRECTORY})
+file(MAKE_DIRECTORY ${DIRECTORY})
+
+execute_process(COMMAND ${PROGRAM} WORKING_DIRECTORY ${DIRECTORY}
+                RESULT_VARIABLE result)
+if(NOT result EQUAL 0)
+  message(FATAL_ERROR "${PROGRAM} failed: ${result}")
+endif()
+
+if(DEFINED TOOL)
+  execute_process(COMMAND ${TOOL} ${TOOL_ARGS} WORKING_DIRECTORY ${DIRECTORY}
+                  OUTPUT_FILE ${DIRECTORY}/${OUTPUT}
+                  RESULT_VARIABLE result)
+  if(NOT result EQUAL 0)
+    message(FATAL_ERROR "${TOOL} failed: ${result}")
+  endif()
+endif()
+
+file(READ ${DIRECTORY}/${OUTPUT} actual)
+string(REPLACE "${SOURCE_DIR}/" "" actual "${actual}")
+string(REGEX REPLACE
+       "[0-9][0-9]\\.[0-9][0-9]\\.[0-9][0-9] [0-9][0-9]:[0-9][0-9]:[0-9][0-9]"
+       "<time>" actual "${actual}")
+string(REGEX MATCHALL "0x[0-9a-f]+" addresses "${actual}")
+list(REMOVE_DUPLICATES addresses)
+set(n 0)
+foreach(address IN LISTS addresses)
+  math(EXPR n "${n} + 1")
+  string(REGEX REPLACE "${address}([^0-9a-f])" "<address ${n}>\\1" actual
+         "${actual}")
+endforeach()
+foreach(prefix IN LISTS NUMBERS_AFTER)
+  string(REGEX REPLACE "(${prefix} *)[0-9]+" "\\1<n>" actual "${actual}")
+endforeach()
+
+file(READ ${EXPECTED} expected)
+if(NOT actual STREQUAL expected)
+  file(WRITE ${DIRECTORY}/actual.txt "${actual}")
+  message(FATAL_ERROR "${OUTPUT} differs from ${EXPECTED}, it's written "
+                      "into ${DIRECTORY}/actual.txt:\n${actual}")
+endif()
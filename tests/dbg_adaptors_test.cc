@@ -0,0 +1,58 @@
+/*
+  The check of the order std::queue, std::stack and std::priority_queue are
+  printed in: queues front to back, stacks top to bottom, priority queues in
+  the heap order with the top first
+*/
+
+
+#include <functional>
+#include <list>
+#include <memory>
+#include <queue>
+#include <stack>
+#include <string>
+#include <vector>
+
+#include "dbg.h"
+
+
+int main() {
+  std::queue<int> queue;
+  std::stack<int> stack;
+  std::stack<int, std::vector<int>> vector_stack;
+  for (int i = 1; i <= 5; ++i) {
+    queue.push(i);
+    stack.push(i);
+    vector_stack.push(i * 10);
+  }
+  queue.pop();
+  stack.pop();
+  dbg(queue, stack, vector_stack);
+  dbg_limit(1, 0, 0, queue, stack);
+
+  std::queue<std::string, std::list<std::string>> names;
+  std::stack<std::string> words;
+  for (const char *s : {"first", "second", "third"}) {
+    names.push(s);
+    words.push(s);
+  }
+  dbg(names, words);
+
+  std::priority_queue<int> largest;
+  std::priority_queue<int, std::vector<int>, std::greater<int>> smallest;
+  // Pushed in the order of the heap, so no element moves and the heap order
+  // is the same in any implementation
+  for (int i : {9, 6, 5, 4, 1, 3, 2, 1}) {
+    largest.push(i);
+  }
+  for (int i : {1, 1, 2, 3, 5, 9, 4, 6}) {
+    smallest.push(i);
+  }
+  dbg(largest.top(), largest, smallest.top(), smallest);
+
+  std::queue<std::unique_ptr<int>> owned;
+  owned.push(std::make_unique<int>(7));
+  owned.push(nullptr);
+  std::stack<int> empty;
+  dbg(owned, empty);
+}
@@ -0,0 +1,119 @@
+/*
+  The check that dbg() allocates nothing in steady state. Each case makes its
+  records once to warm up, then again while operator new is counted on all
+  the threads, the background writer too, and fails if it was called. The
+  sink is the one dbg_alloc_test_<sink> is compiled for, see
+  tests/CMakeLists.txt
+*/
+
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "dbg.h"
+
+
+// Allocations made by all the threads, counted by the global operator new
+std::atomic<size_t> allocations{0};
+
+void *operator new(size_t size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  if (void *p = std::malloc(size == 0 ? 1 : size)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept {
+  std::free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+  std::free(p);
+}
+
+
+namespace {
+
+// The records each case makes to warm up and then the ones it's checked on
+constexpr int kWarmUpRecords = 2000;
+constexpr int kCheckedRecords = 2000;
+
+// The classes from the README, nested with DERIVE_DEBUG
+class Foo {
+  class Bar {
+    float pi = 3.14, e = 2.71;
+    std::shared_ptr<float> count{std::make_shared<float>(9.81)};
+
+   public:
+    DERIVE_DEBUG(pi * e, count);
+  };
+
+  std::map<std::string, float> map{{"light speed", 2.9e+8},
+                                   {"electron mass", 9.1e-31}};
+  std::vector<Bar> bars{Bar()};
+
+ public:
+  DERIVE_DEBUG(map, bars);
+};
+
+// Make the records of the case, the warm-up ones first, and tell if the
+// checked ones allocated nothing
+template <class F>
+bool NoAllocations(const char *name, F make_record) {
+  for (int i = 0; i < kWarmUpRecords; ++i) {
+    make_record();
+  }
+  size_t before = allocations.load();
+  for (int i = 0; i < kCheckedRecords; ++i) {
+    make_record();
+  }
+  size_t made = allocations.load() - before;
+  if (made != 0) {
+    std::fprintf(stderr, "%s: %zu allocations in %d records\n", name, made,
+                 kCheckedRecords);
+    return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+
+int main() {
+  int x = 42;
+  std::string msg = "dbg is fun!";
+  std::vector<int> values(1000);
+  for (size_t i = 0; i < values.size(); ++i) {
+    values[i] = static_cast<int>(i * 2654435761u);
+  }
+  std::map<std::string, float> map;
+  for (int i = 0; i < 100; ++i) {
+    map.emplace("key " + std::to_string(i), i * 0.5f);
+  }
+  std::vector<uint8_t> packet(1500);
+  for (size_t i = 0; i < packet.size(); ++i) {
+    packet[i] = static_cast<uint8_t>(i * 2654435761u >> 24);
+  }
+  std::vector<Foo> foos(10);
+  int i = 0;
+
+  bool ok = true;
+  ok &= NoAllocations("scalar", [&] { dbg(x); });
+  ok &= NoAllocations("string", [&] { dbg(msg); });
+  ok &= NoAllocations("vector", [&] { dbg(values); });
+  ok &= NoAllocations("map", [&] { dbg(map); });
+  ok &= NoAllocations("bytes", [&] { dbg(packet); });
+  ok &= NoAllocations("nested", [&] { dbg(foos); });
+  ok &= NoAllocations("diff", [&] { dbg_diff(foos); });
+  ok &= NoAllocations("time", [&] { dbg_time(); });
+  ok &= NoAllocations("count", [&] { dbg_count(++i % 8); });
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,18 @@
+/*
+  The check that the records and the summaries made at exit reach the log of
+  the compiled core with DBG_ASYNC. The program is linked before the core, as
+  CMake links it, so its globals are constructed first and destroyed last
+*/
+
+
+#include "dbg.h"
+
+
+int main() {
+  for (int i = 0; i < 5; ++i) {
+    dbg_time("loop");
+    dbg_count(i % 2);
+  }
+  int x = 7;
+  dbg(x);
+}
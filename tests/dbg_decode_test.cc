@@ -0,0 +1,58 @@
+/*
+  The round trip of the binary log: built with DBG_BINARY_LOG and decoded by
+  dbg_decode, and built without it, the program must give the same text. It
+  has the scalars of each code, the strings, the contiguous ranges written
+  raw, with and without the element limit, and the values printed as text
+*/
+
+
+#include <array>
+#include <cstdint>
+#include <map>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "dbg.h"
+
+
+struct Point {
+  int x = 1;
+  double y = -0.25;
+
+  DERIVE_DEBUG(x, y);
+};
+
+
+int main() {
+  bool flag = true;
+  char c = 'z';
+  int16_t small = -300;
+  uint32_t medium = 4000000000;
+  int64_t large = -9000000000000;
+  uint64_t huge = UINT64_MAX;
+  float f = 1.5f;
+  double d = 3.14159265358979;
+  dbg(flag, c, small, medium, large, huge, f, d);
+
+  std::string text = "two\nlines";
+  std::string_view view = "a view";
+  dbg(text, view, "literal");
+
+  std::vector<int> numbers = {1, 2, 3, 4, 5, 6, 7, 8};
+  std::array<double, 3> array = {0.5, -1, 1e100};
+  std::span<const int> span(numbers.data() + 2, 3);
+  std::vector<float> empty;
+  dbg(numbers, array, span, empty);
+  dbg_limit(2, 0, 0, numbers);
+
+  std::map<std::string, int> map = {{"one", 1}, {"two", 2}};
+  Point point;
+  std::vector<Point> points(2);
+  dbg(map, point, points);
+
+  for (int i = 0; i < 3; ++i) {
+    dbg(i, numbers[i]);
+  }
+}
@@ -0,0 +1,49 @@
+/*
+  The check of what dbg_diff() shows: all of the first record, then only the
+  changed arguments, fields, elements of the ranges of classes and map
+  entries, and no record if nothing changed
+*/
+
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "dbg.h"
+
+
+struct Worker {
+  int id = 0;
+  bool busy = false;
+
+  DERIVE_DEBUG(id, busy);
+};
+
+struct State {
+  std::vector<Worker> workers;
+  std::map<std::string, int> queues;
+  int epoch = 0;
+
+  DERIVE_DEBUG(workers, queues, epoch);
+};
+
+
+int main() {
+  State state{{{1, false}, {2, false}, {3, true}}, {{"a", 1}, {"b", 2}}, 5};
+  std::vector<int> totals = {1, 2};
+  for (int i = 0; i < 6; ++i) {
+    if (i == 1) {
+      state.workers[1].busy = true;
+    } else if (i == 2) {
+      state.queues["b"] = 7;
+      totals.push_back(3);
+    } else if (i == 3) {
+      state.epoch = 6;
+      state.queues["c"] = 1;
+      state.workers.pop_back();
+    } else if (i == 5) {
+      state.workers[0].id = 10;
+    }
+    dbg_diff(state, totals);
+  }
+}
@@ -0,0 +1,61 @@
+/*
+  The check of the call sites DBG_FILTER selects: the globs of the files and
+  the functions, the patterns read from a file, the empty filter, no filter
+  and the counts of the sites that aren't selected. Run with
+  DBG_FILTER=other.cc,tests/dbg_filter_?est.cc:Parse*,dbg_*.cc:Keep?
+*/
+
+
+#include <cstdlib>
+#include <fstream>
+
+#include "dbg.h"
+
+
+void ParseHeader(int i) {
+  dbg(i);
+}
+
+void ParseBody(int i) {
+  dbg(i);
+  dbg_count(i);
+}
+
+void Keep(int i) {
+  dbg(i);
+  dbg_count(i);
+}
+
+void Keeps(int i) {
+  dbg(i);
+}
+
+void Drop(int i) {
+  dbg(i);
+}
+
+void CallAll(int i) {
+  ParseHeader(i);
+  ParseBody(i);
+  Keep(i);
+  Keeps(i);
+  Drop(i);
+}
+
+
+int main() {
+  CallAll(1);
+
+  std::ofstream("dbg.filter") << "*:Drop\nother.cc:*,*test.cc:Keep\n";
+  setenv("DBG_FILTER", "@dbg.filter", 1);
+  RELOAD_DEBUG_FILTER
+  CallAll(2);
+
+  setenv("DBG_FILTER", "", 1);
+  RELOAD_DEBUG_FILTER
+  CallAll(3);
+
+  unsetenv("DBG_FILTER");
+  RELOAD_DEBUG_FILTER
+  CallAll(4);
+}
@@ -0,0 +1,47 @@
+/*
+  The check of the layout of the hex dumps: the offsets, the gap after the
+  8th byte, the chars, the short last line, the object representations, the
+  ranges of bytes dumped by dbg() and the skipped bytes
+*/
+
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "dbg.h"
+
+
+struct Header {
+  uint8_t version = 2;
+  uint8_t flags = 0x80;
+  uint16_t length = 0x0102;
+  char tag[4] = {'d', 'b', 'g', '!'};
+};
+
+
+int main() {
+  std::string request = "GET / HTTP/1.1\r\nHost: example.com\r\n\r\n";
+  std::string line = "0123456789abcdef";
+  std::string empty;
+  dbg_hex(request, line, empty);
+
+  Header header;
+  char c = 'A';
+  dbg_hex(header, c);
+
+  std::vector<uint8_t> bytes;
+  for (int i = 0; i < 40; ++i) {
+    bytes.push_back(static_cast<uint8_t>(i * 7));
+  }
+  std::array<std::byte, 3> raw = {std::byte{0}, std::byte{0x7f},
+                                  std::byte{0xff}};
+  dbg(bytes, raw);
+
+  std::vector<uint8_t> long_bytes(100, 0x41);
+  LIMIT_DEBUG(20, 0, 0)
+  dbg(long_bytes);
+  LIMIT_DEBUG(0, 0, 0)
+}
@@ -0,0 +1,47 @@
+/*
+  The check of the records of DBG_JSON_LOG: the escaping of the strings, the
+  names and the chars, the numbers that aren't finite, the containers, the
+  maps and the classes, and the limits
+*/
+
+
+#include <cmath>
+#include <limits>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "dbg.h"
+
+
+struct Point {
+  int x = 1;
+  double y = 0.5;
+  std::string label = "a \"b\"";
+
+  DERIVE_DEBUG(x, y, label);
+};
+
+
+int main() {
+  std::string quotes = "say \"hi\" to C:\\dir";
+  std::string controls = "tab\tline\nbell\a\x1f end";
+  std::string utf8 = "grüße, 日本";
+  char quote = '"';
+  char newline = '\n';
+  dbg(quotes, controls, utf8, quote, newline);
+  dbg("a \"literal\"\n", true);
+
+  double nan = std::numeric_limits<double>::quiet_NaN();
+  std::vector<double> numbers = {1.5, -2, nan, INFINITY, -INFINITY};
+  dbg(numbers);
+
+  std::map<std::string, std::vector<int>> map = {{"k\"1", {1, 2}}, {"k2", {}}};
+  std::vector<Point> points(2);
+  dbg(map, points);
+
+  std::vector<int> many(10, 3);
+  std::vector<std::vector<int>> nested = {{1}, {2, 3}};
+  dbg_limit(2, 1, 0, many, nested);
+  dbg_limit(0, 0, 150, many, points);
+}
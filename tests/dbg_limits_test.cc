@@ -0,0 +1,44 @@
+/*
+  The check of the limits: the elements skipped between the head and the tail
+  of the containers, the blocks nested too deep and the records cut at the
+  size limit, given per call and for all records
+*/
+
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "dbg.h"
+
+
+int main() {
+  std::vector<int> numbers;
+  for (int i = 0; i < 10; ++i) {
+    numbers.push_back(i);
+  }
+  dbg_limit(3, 0, 0, numbers);
+  dbg_limit(5, 0, 0, numbers);
+  dbg_limit(4, 0, 0, numbers);
+
+  std::vector<std::string> lines = {"a", "b", "c", "d", "e", "f", "g"};
+  dbg_limit(2, 0, 0, lines);
+
+  std::map<int, std::vector<std::vector<int>>> nested = {
+      {1, {{1, 2}, {3}}},
+      {2, {{4}}},
+  };
+  dbg_limit(0, 2, 0, nested);
+  dbg_limit(0, 1, 0, nested);
+
+  std::string text(200, 'x');
+  dbg_limit(0, 0, 100, numbers, text, lines);
+  std::vector<int> many(100, 5);
+  dbg_limit(0, 0, 100, many);
+
+  LIMIT_DEBUG(1, 0, 0)
+  dbg(numbers);
+  dbg_limit(2, 0, 0, numbers);
+  LIMIT_DEBUG(0, 0, 0)
+  dbg(numbers);
+}
@@ -0,0 +1,35 @@
+/*
+  The merge of the shards of DBG_SHARDED_LOG by dbg_merge: the main thread
+  writes dbg.0.log, the thread it starts dbg.1.log and the one started after
+  it has exited takes over the same file. Each thread is joined before the
+  next record, so the merged log must have the records in the order of
+  their numbers
+*/
+
+
+#include <string>
+#include <thread>
+
+#include "dbg.h"
+
+
+int main() {
+  int record = 1;
+  dbg(record);
+  std::thread([] {
+    int record = 2;
+    dbg(record);
+    std::string from = "first thread";
+    record = 3;
+    dbg(record, from);
+  }).join();
+  record = 4;
+  dbg(record);
+  std::thread([] {
+    int record = 5;
+    std::string from = "second thread";
+    dbg(record, from);
+  }).join();
+  record = 6;
+  dbg(record);
+}
@@ -0,0 +1,57 @@
+/*
+  The check of the smart pointers: nullptr, the class object behind
+  std::shared_ptr printed once per record and referred to by the pointers
+  it's seen behind again, in a cycle, in a DAG and through the aliases of
+  its members
+*/
+
+
+#include <memory>
+#include <vector>
+
+#include "dbg.h"
+
+
+struct Node {
+  int value = 0;
+  std::shared_ptr<Node> next;
+
+  DERIVE_DEBUG(value, next);
+};
+
+struct Pair {
+  Node first;
+  Node second;
+
+  DERIVE_DEBUG(first, second);
+};
+
+
+int main() {
+  std::shared_ptr<Node> none;
+  std::unique_ptr<Node> owned;
+  dbg(none, owned);
+
+  auto head = std::make_shared<Node>(Node{1, nullptr});
+  head->next = std::make_shared<Node>(Node{2, head});
+  dbg(head);
+  dbg(head->next);
+
+  auto leaf = std::make_shared<Node>(Node{3, nullptr});
+  std::vector<std::shared_ptr<Node>> parents = {
+      std::make_shared<Node>(Node{4, leaf}),
+      std::make_shared<Node>(Node{5, leaf})};
+  dbg(parents, leaf);
+
+  auto pair = std::make_shared<Pair>();
+  pair->first.value = 6;
+  std::shared_ptr<Node> first(pair, &pair->first);
+  std::shared_ptr<const Node> same_first(pair, &pair->first);
+  std::shared_ptr<Node> second(pair, &pair->second);
+  dbg(pair, first, same_first, second);
+
+  auto number = std::make_shared<int>(7);
+  dbg(number, number);
+
+  head->next->next.reset();
+}
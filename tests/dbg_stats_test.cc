@@ -0,0 +1,44 @@
+/*
+  The check of the numbers of dbg_stats() on known data: the lanes and their
+  tails, the ranges of integers, the non-contiguous ones, the NaN and the
+  infinities counted aside, the single value and the empty range
+*/
+
+
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <list>
+#include <vector>
+
+#include "dbg.h"
+
+
+int main() {
+  std::vector<double> ones_to_sixteen;
+  for (int i = 1; i <= 16; ++i) {
+    ones_to_sixteen.push_back(i);
+  }
+  std::vector<double> halves;
+  for (int i = 0; i <= 1000; ++i) {
+    halves.push_back(i * 0.5);
+  }
+  dbg_stats(ones_to_sixteen, halves);
+
+  std::vector<int> squares;
+  for (int i = 0; i < 33; ++i) {
+    squares.push_back(i * i);
+  }
+  std::list<int64_t> negative = {-5, -1, -3, -2, -4};
+  dbg_stats(squares, negative);
+
+  float nan = std::numeric_limits<float>::quiet_NaN();
+  float inf = std::numeric_limits<float>::infinity();
+  std::vector<float> special = {nan, 1, inf, 2, -inf, 3, nan};
+  std::vector<float> only_nan = {nan, nan};
+  dbg_stats(special, only_nan);
+
+  std::vector<double> single = {4.25};
+  std::vector<double> empty;
+  dbg_stats(single, empty);
+}
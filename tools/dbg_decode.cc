@@ -0,0 +1,349 @@
+/*
+  Decoder of the binary log that dbg.h writes with DBG_BINARY_LOG defined.
+  Renders the log into the very text dbg.log would have:
+
+    dbg_decode [<binary log> [<text log>]]
+
+  By default reads dbg.bin and writes to stdout. Type names, argument names
+  and times are taken from the log, so it's decoded the same on any machine
+  of the same byte order. The local time is the one of the decoding machine
+
+  The format is described next to __dbg_internal::kBinaryMagic in dbg.h
+*/
+
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cstdint>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+
+namespace {
+
+constexpr std::string_view kBinaryMagic = "DBGBIN";
+constexpr uint8_t kBinaryVersion = 1;
+constexpr uint32_t kBinaryByteOrder = 0x01020304;
+
+constexpr uint8_t kMonotonicTimeFlag = 1;
+constexpr uint8_t kRoundTripFloatsFlag = 2;
+
+enum class EntryTag : char {
+  kSite = 'S',
+  kRecord = 'R',
+};
+
+enum class ValueTag : char {
+  kScalar = 'V',
+  kArray = 'A',
+  kString = 'Z',
+  kText = 'T',
+};
+
+enum class ScalarCode : uint8_t {
+  kBool,
+  kChar,
+  kInt8,
+  kInt16,
+  kInt32,
+  kInt64,
+  kUInt8,
+  kUInt16,
+  kUInt32,
+  kUInt64,
+  kFloat,
+  kDouble,
+};
+
+// What the site entry tells about the call site
+struct Site {
+  uint32_t line = 0;
+  std::string file;
+  std::string func;
+  std::vector<std::string> names;
+  std::vector<std::string> types;
+};
+
+// The log is broken where it can't be read further
+struct BrokenLog {
+  std::string reason;
+};
+
+// Reads the raw values of the log one after another
+class Reader {
+ public:
+  explicit Reader(std::istream &in) : in_(in) {
+  }
+
+  // Tell if the log ends right here, between the entries
+  bool AtEnd() {
+    return in_.peek() == std::char_traits<char>::eof();
+  }
+
+  void Bytes(char *data, size_t size) {
+    if (!in_.read(data, size)) {
+      throw BrokenLog{"the log ends in the middle of the entry"};
+    }
+  }
+
+  template <class T>
+  T Raw() {
+    T x;
+    Bytes(reinterpret_cast<char *>(&x), sizeof(x));
+    return x;
+  }
+
+  std::string String() {
+    std::string text(Raw<uint64_t>(), '\0');
+    Bytes(text.data(), text.size());
+    return text;
+  }
+
+ private:
+  std::istream &in_;
+};
+
+// Renders the entries into the text log
+class Decoder {
+ public:
+  Decoder(Reader &reader, std::ostream &out) : reader_(reader), out_(out) {
+  }
+
+  void Run() {
+    while (!reader_.AtEnd()) {
+      char tag = reader_.Raw<char>();
+      if (tag == kBinaryMagic[0]) {
+        Header();
+      } else if (tag == static_cast<char>(EntryTag::kSite)) {
+        SiteEntry();
+      } else if (tag == static_cast<char>(EntryTag::kRecord)) {
+        Record();
+      } else {
+        throw BrokenLog{"unknown entry"};
+      }
+    }
+  }
+
+ private:
+  // The header starts each run of the program, the ids start over with it
+  void Header() {
+    std::string magic(kBinaryMagic.size(), kBinaryMagic[0]);
+    reader_.Bytes(magic.data() + 1, magic.size() - 1);
+    if (magic != kBinaryMagic) {
+      throw BrokenLog{"not a binary log of dbg.h"};
+    }
+    if (reader_.Raw<uint8_t>() != kBinaryVersion) {
+      throw BrokenLog{"unsupported version of the log"};
+    }
+    flags_ = reader_.Raw<uint8_t>();
+    if (reader_.Raw<uint32_t>() != kBinaryByteOrder) {
+      throw BrokenLog{"the log is written in the other byte order"};
+    }
+    sites_.clear();
+    was_record_ = false;
+  }
+
+  void SiteEntry() {
+    uint32_t id = reader_.Raw<uint32_t>();
+    Site site;
+    site.line = reader_.Raw<uint32_t>();
+    site.file = reader_.String();
+    site.func = reader_.String();
+    for (uint32_t count = reader_.Raw<uint32_t>(); count > 0; --count) {
+      site.names.push_back(reader_.String());
+      site.types.push_back(reader_.String());
+    }
+    if (id >= sites_.size()) {
+      sites_.resize(id + 1);
+    }
+    sites_[id] = std::move(site);
+  }
+
+  void Record() {
+    uint32_t id = reader_.Raw<uint32_t>();
+    if (id >= sites_.size() || sites_[id].file.empty()) {
+      throw BrokenLog{"the record of unknown call site"};
+    }
+    const Site &site = sites_[id];
+    int64_t time = reader_.Raw<int64_t>();
+
+    text_.clear();
+    if (was_record_) {
+      text_ += "\n";
+    }
+    was_record_ = true;
+    text_ += "[" + site.file + ":" + std::to_string(site.line) + " (" +
+             site.func + ") ";
+    Time(time);
+    text_ += "]\n";
+    for (size_t i = 0; i < site.names.size(); ++i) {
+      text_ += site.names[i] + ": " + site.types[i] + " = ";
+      Value();
+      text_ += "\n";
+    }
+    out_ << text_;
+  }
+
+  // <dd.mm.yy HH:MM:SS> of the local time, or <seconds>.<nanoseconds> of
+  // steady_clock, as dbg.h prints it
+  void Time(int64_t ns) {
+    std::array<char, 32> text;
+    if (flags_ & kMonotonicTimeFlag) {
+      char *end =
+          std::to_chars(text.data(), text.data() + 20, ns / 1000000000).ptr;
+      *end++ = '.';
+      auto fraction = ns % 1000000000;
+      for (int i = 8; i >= 0; --i, fraction /= 10) {
+        end[i] = static_cast<char>('0' + fraction % 10);
+      }
+      text_.append(text.data(), end + 9);
+      return;
+    }
+    std::time_t timestamp = ns / 1000000000;
+    std::tm now;
+#if defined(_MSC_VER)
+    localtime_s(&now, &timestamp);
+#else
+    localtime_r(&timestamp, &now);
+#endif
+    text_.append(text.data(), std::strftime(text.data(), text.size(),
+                                            "%d.%m.%y %H:%M:%S", &now));
+  }
+
+  void Value() {
+    auto tag = static_cast<ValueTag>(reader_.Raw<char>());
+    switch (tag) {
+      case ValueTag::kScalar:
+        Scalar(static_cast<ScalarCode>(reader_.Raw<uint8_t>()));
+        return;
+      case ValueTag::kArray:
+        Array();
+        return;
+      case ValueTag::kString:
+        text_ += "\"" + reader_.String() + "\"";
+        return;
+      case ValueTag::kText:
+        text_ += reader_.String();
+        return;
+    }
+    throw BrokenLog{"unknown value"};
+  }
+
+  // {1, 2, ... 96 more ..., 99, 100}
+  void Array() {
+    auto code = static_cast<ScalarCode>(reader_.Raw<uint8_t>());
+    uint64_t size = reader_.Raw<uint64_t>();
+    uint64_t edge = reader_.Raw<uint64_t>();
+    text_ += "{";
+    for (uint64_t i = 0; i < std::min(size, 2 * edge); ++i) {
+      if (i > 0) {
+        text_ += ", ";
+      }
+      if (i == edge && edge < size) {
+        text_ += "... " + std::to_string(size - 2 * edge) + " more ..., ";
+      }
+      Scalar(code);
+    }
+    text_ += "}";
+  }
+
+  void Scalar(ScalarCode code) {
+    switch (code) {
+      case ScalarCode::kBool:
+        text_ += reader_.Raw<uint8_t>() ? '1' : '0';
+        return;
+      case ScalarCode::kChar:
+        text_ += reader_.Raw<char>();
+        return;
+      case ScalarCode::kInt8:
+        return Number(reader_.Raw<int8_t>());
+      case ScalarCode::kInt16:
+        return Number(reader_.Raw<int16_t>());
+      case ScalarCode::kInt32:
+        return Number(reader_.Raw<int32_t>());
+      case ScalarCode::kInt64:
+        return Number(reader_.Raw<int64_t>());
+      case ScalarCode::kUInt8:
+        return Number(reader_.Raw<uint8_t>());
+      case ScalarCode::kUInt16:
+        return Number(reader_.Raw<uint16_t>());
+      case ScalarCode::kUInt32:
+        return Number(reader_.Raw<uint32_t>());
+      case ScalarCode::kUInt64:
+        return Number(reader_.Raw<uint64_t>());
+      case ScalarCode::kFloat:
+        return Number(reader_.Raw<float>());
+      case ScalarCode::kDouble:
+        return Number(reader_.Raw<double>());
+    }
+    throw BrokenLog{"unknown scalar type"};
+  }
+
+  // Formatted as dbg.h formats it
+  template <class T>
+  void Number(T x) {
+    std::array<char, 64> text;
+    char *end;
+    if constexpr (std::is_floating_point_v<T>) {
+      if (flags_ & kRoundTripFloatsFlag) {
+        end = std::to_chars(text.data(), text.data() + text.size(), x).ptr;
+      } else {
+        end = std::to_chars(text.data(), text.data() + text.size(), x,
+                            std::chars_format::general, 6)
+                  .ptr;
+      }
+    } else {
+      end = std::to_chars(text.data(), text.data() + text.size(), x).ptr;
+    }
+    text_.append(text.data(), end);
+  }
+
+  Reader &reader_;
+  std::ostream &out_;
+  uint8_t flags_ = 0;
+  std::vector<Site> sites_;
+  bool was_record_ = false;
+  // The text of the record being decoded
+  std::string text_;
+};
+
+}  // namespace
+
+
+int main(int argc, char **argv) {
+  const char *input = argc > 1 ? argv[1] : "dbg.bin";
+  std::ifstream in(input, std::ios_base::binary);
+  if (!in) {
+    std::cerr << "dbg_decode: can't open " << input << "\n";
+    return 1;
+  }
+  std::ofstream file;
+  if (argc > 2) {
+    file.open(argv[2]);
+    if (!file) {
+      std::cerr << "dbg_decode: can't open " << argv[2] << "\n";
+      return 1;
+    }
+  }
+  std::ostream &out = argc > 2 ? file : std::cout;
+
+  Reader reader(in);
+  Decoder decoder(reader, out);
+  try {
+    decoder.Run();
+  } catch (const BrokenLog &broken) {
+    // A crashed process leaves the last entry unfinished, what's before it is
+    // decoded anyway
+    out.flush();
+    std::cerr << "dbg_decode: " << input << ": " << broken.reason << "\n";
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,153 @@
+/*
+  Merger of the files that dbg.h writes with DBG_SHARDED_LOG defined, one per
+  thread. Writes the records of all files to stdout in the order they were
+  made, as one dbg.log or dbg.ndjson would have them:
+
+    dbg_merge dbg.*.log > dbg.log
+    dbg_merge dbg.*.ndjson > dbg.ndjson
+
+  The records are ordered by the time of std::chrono::steady_clock they were
+  written at, the ones of the same time by their numbers in the files. The
+  frame is described next to __dbg_internal::kShardFrame in dbg.h
+*/
+
+
+#include <charconv>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <queue>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <vector>
+
+
+namespace {
+
+constexpr std::string_view kShardFrame = "#dbg ";
+
+// The file is broken where it can't be read further
+struct BrokenShard {
+  std::string reason;
+};
+
+// The record read from the file along with its frame
+struct Record {
+  uint64_t ns = 0;
+  uint64_t seq = 0;
+  std::string text;
+};
+
+// Reads the framed records of one file one after another
+class Shard {
+ public:
+  explicit Shard(const char *name) : name_(name), in_(name) {
+  }
+
+  const char *Name() const {
+    return name_;
+  }
+
+  bool IsOpen() const {
+    return in_.is_open();
+  }
+
+  // Read the next record, returns false at the end of the file
+  bool Next(Record &record) {
+    std::string line;
+    if (!std::getline(in_, line)) {
+      return false;
+    }
+    if (!line.starts_with(kShardFrame)) {
+      throw BrokenShard{"the record isn't framed"};
+    }
+    const char *pos = line.data() + kShardFrame.size();
+    const char *end = line.data() + line.size();
+    uint64_t size = 0;
+    for (uint64_t *x : {&record.ns, &record.seq, &size}) {
+      auto [ptr, error] = std::from_chars(pos, end, *x);
+      if (error != std::errc() || (ptr != end && *ptr != ' ')) {
+        throw BrokenShard{"the frame of the record is broken"};
+      }
+      pos = ptr == end ? ptr : ptr + 1;
+    }
+    record.text.resize(size);
+    if (!in_.read(record.text.data(), size)) {
+      throw BrokenShard{"the file ends in the middle of the record"};
+    }
+    return true;
+  }
+
+ private:
+  const char *name_;
+  std::ifstream in_;
+};
+
+// The text records are separated by one more \n, the JSON lines need nothing
+// in between. The files tell which ones they hold by the extension
+std::string_view RecordSeparator(int argc, char **argv) {
+  for (int i = 1; i < argc; ++i) {
+    if (!std::string_view(argv[i]).ends_with(".ndjson")) {
+      return "\n";
+    }
+  }
+  return "";
+}
+
+}  // namespace
+
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    std::cerr << "usage: dbg_merge <file>...\n";
+    return 1;
+  }
+  std::vector<Shard> shards;
+  shards.reserve(argc - 1);
+  for (int i = 1; i < argc; ++i) {
+    shards.emplace_back(argv[i]);
+    if (!shards.back().IsOpen()) {
+      std::cerr << "dbg_merge: can't open " << argv[i] << "\n";
+      return 1;
+    }
+  }
+
+  // The next record of each file, the earliest one of them is written first
+  std::vector<Record> records(shards.size());
+  using Head = std::tuple<uint64_t, uint64_t, size_t>;
+  std::priority_queue<Head, std::vector<Head>, std::greater<>> heads;
+  bool broken = false;
+  auto next = [&](size_t i) {
+    try {
+      if (shards[i].Next(records[i])) {
+        heads.emplace(records[i].ns, records[i].seq, i);
+      }
+    } catch (const BrokenShard &shard) {
+      // A crashed process leaves the last record unfinished, what's before it
+      // is merged anyway
+      std::cerr << "dbg_merge: " << shards[i].Name() << ": " << shard.reason
+                << "\n";
+      broken = true;
+    }
+  };
+  for (size_t i = 0; i < shards.size(); ++i) {
+    next(i);
+  }
+
+  std::string_view separator = RecordSeparator(argc, argv);
+  bool was_record = false;
+  while (!heads.empty()) {
+    size_t i = std::get<2>(heads.top());
+    heads.pop();
+    if (was_record) {
+      std::cout << separator;
+    }
+    was_record = true;
+    std::cout << records[i].text;
+    next(i);
+  }
+  std::cout.flush();
+  return broken ? 1 : 0;
+}